@@ -0,0 +1,95 @@
+#include "Cache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// Lookups and evaluations per second of the program caches under contention.
+// The baseline is the single-threaded LRU cache behind one mutex.
+
+using namespace Interpreter;
+
+namespace {
+
+std::vector<std::wstring> MakeExpressions(size_t count) {
+    std::vector<std::wstring> expressions;
+    for(size_t i = 0; i < count; ++i) {
+        expressions.push_back(L"(x + " + std::to_wstring(i) + L") * (x - " + std::to_wstring(i % 7) + L") / 3");
+    }
+    return expressions;
+}
+
+// Same interface as the sharded cache, every lookup takes the lock.
+class LockedProgramCache {
+public:
+    class Reader {
+    public:
+        explicit Reader(LockedProgramCache &cache) : m_cache(cache) {}
+
+        double Evaluate(const std::wstring &expression, const Bindings &bindings) {
+            Cache::ProgramPtr program;
+            {
+                std::lock_guard<std::mutex> lock(m_cache.m_mutex);
+                program = m_cache.m_cache.Get(expression);
+            }
+            return program->Evaluate(bindings, m_scratch);
+        }
+
+    private:
+        LockedProgramCache &m_cache;
+        Compiler::Scratch m_scratch;
+    };
+
+private:
+    std::mutex m_mutex;
+    Cache::ProgramCache m_cache;
+};
+
+// Every thread does the same number of operations on expressions already in the cache.
+template<typename C> double OperationsPerSecond(C &cache, const std::vector<std::wstring> &expressions, size_t threads, size_t operations) {
+    {
+        typename C::Reader reader(cache);
+        for(const auto &expression : expressions) reader.Evaluate(expression, { { L"x", 0 } });
+    }
+    std::atomic<bool> start{ false };
+    std::vector<double> sums(threads);
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            typename C::Reader reader(cache);
+            while(!start.load()) std::this_thread::yield();
+            const Bindings bindings{ { L"x", double(t) } };
+            double sum = 0;
+            for(size_t i = 0; i < operations; ++i) {
+                sum += reader.Evaluate(expressions[(i * 7919 + t) % expressions.size()], bindings);
+            }
+            sums[t] = sum;
+        });
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start = true;
+    for(auto &worker : workers) worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return threads * operations / elapsed.count();
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+    const size_t operations = quick ? 2000 : 100000;
+    const auto expressions = MakeExpressions(256);
+
+    std::printf("%8s %16s %16s %8s\n", "threads", "mutex ops/s", "sharded ops/s", "speedup");
+    for(size_t threads : { 1, 8, 64 }) {
+        LockedProgramCache locked;
+        Cache::ShardedProgramCache sharded;
+        const double lockedRate = OperationsPerSecond(locked, expressions, threads, operations);
+        const double shardedRate = OperationsPerSecond(sharded, expressions, threads, operations);
+        std::printf("%8zu %16.0f %16.0f %8.2f\n", threads, lockedRate, shardedRate, shardedRate / lockedRate);
+        if(sharded.Misses() != expressions.size()) {
+            std::printf("unexpected misses: %zu\n", sharded.Misses());
+            return 1;
+        }
+    }
+    return 0;
+}
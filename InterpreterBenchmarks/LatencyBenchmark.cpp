@@ -0,0 +1,140 @@
+#include "Generator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Latency percentiles of InterpreteExperssion on short formulas, each call timed on its own.
+// Warm runs repeat the formulas back to back; cold runs sweep a buffer bigger than the caches
+// before every call. The first call of the process, which builds the static tables, is
+// reported apart.
+
+using namespace Interpreter;
+
+namespace {
+
+// Log-linear histogram in the manner of HdrHistogram: values below 256 ns are exact, above
+// that every power of two is split into 128 buckets, so a value is off by less than 1%. Every
+// 64-bit value has a bucket.
+class Histogram {
+public:
+    Histogram() : m_counts(Buckets) {}
+
+    void Record(uint64_t value) {
+        ++m_counts[IndexOf(value)];
+        ++m_total;
+        m_max = std::max(m_max, value);
+    }
+
+    // Highest value of the bucket that holds the given fraction of the records.
+    uint64_t Percentile(double fraction) const {
+        const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(fraction * m_total)));
+        uint64_t seen = 0;
+        for(size_t index = 0; index < m_counts.size(); ++index) {
+            seen += m_counts[index];
+            if(seen >= rank) return std::min(HighestOf(index), m_max);
+        }
+        return m_max;
+    }
+
+    uint64_t Max() const {
+        return m_max;
+    }
+
+private:
+    static const int SubBits = 7;
+    static const uint64_t SubCount = 1 << SubBits;
+    // Exact values below 2 * SubCount, then SubCount buckets for each length from SubBits + 2 to 64 bits.
+    static const size_t Buckets = (64 - SubBits + 1) * SubCount;
+
+    static size_t IndexOf(uint64_t value) {
+        if(value < 2 * SubCount) return size_t(value);
+        int length = 0;
+        while(length < 64 && value >> length) ++length;
+        const int shift = length - SubBits - 1;
+        return size_t((shift + 1) * SubCount + (value >> shift) - SubCount);
+    }
+
+    static uint64_t HighestOf(size_t index) {
+        if(index < 2 * SubCount) return index;
+        const int shift = int(index / SubCount) - 1;
+        return ((index % SubCount + SubCount + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total = 0;
+    uint64_t m_max = 0;
+};
+
+uint64_t Nanoseconds(std::chrono::steady_clock::duration duration) {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+// Representative formulas: a few written by hand and the short generated corpus.
+std::vector<std::wstring> MakeFormulas(size_t count) {
+    std::vector<std::wstring> formulas = { L"1-(2+3/-1*-2)", L"x*1.05", L"(a+b)/2", L"price*(1-discount)+tax" };
+    Generator::ExpressionGenerator generator(Generator::CannedCorpora()[0].m_options);
+    while(formulas.size() < count) formulas.push_back(generator.Next());
+    return formulas;
+}
+
+// Every value is reported by a bucket no lower and less than 1% higher, up to the largest one.
+bool CheckHistogram() {
+    const uint64_t values[] = { 0, 255, 256, 1000, 123456789, uint64_t(1) << 62, uint64_t(1) << 63, UINT64_MAX - 1, UINT64_MAX };
+    for(uint64_t value : values) {
+        Histogram histogram;
+        histogram.Record(value);
+        histogram.Record(UINT64_MAX);
+        const uint64_t reported = histogram.Percentile(0.5);
+        if(reported < value || reported - value > value / 100) {
+            std::printf("%llu is reported as %llu\n", (unsigned long long)value, (unsigned long long)reported);
+            return false;
+        }
+    }
+    return true;
+}
+
+void Report(const char *name, const Histogram &histogram) {
+    std::printf("%-6s %10llu %10llu %10llu %10llu %10llu\n", name, (unsigned long long)histogram.Percentile(0.5), (unsigned long long)histogram.Percentile(0.9),
+                (unsigned long long)histogram.Percentile(0.99), (unsigned long long)histogram.Percentile(0.999), (unsigned long long)histogram.Max());
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if(argc > 1 && std::strcmp(argv[1], "--check") == 0) return CheckHistogram() ? 0 : 1;
+    const bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+    const size_t warmCalls = quick ? 10000 : 2000000;
+    const size_t coldCalls = quick ? 100 : 5000;
+    const auto formulas = MakeFormulas(1000);
+    const Bindings bindings{ { L"x", 0.5 }, { L"y", 2 }, { L"z", -3 }, { L"a", 1 }, { L"b", 4 }, { L"price", 10 }, { L"discount", 0.1 }, { L"tax", 2 } };
+    double sink = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    sink += InterpreteExperssion(formulas[0], bindings);
+    std::printf("first call %llu ns\n\n", (unsigned long long)Nanoseconds(std::chrono::steady_clock::now() - begin));
+
+    std::printf("%-6s %10s %10s %10s %10s %10s\n", "ns", "p50", "p90", "p99", "p99.9", "max");
+    Histogram warm;
+    for(size_t i = 0; i < warmCalls; ++i) {
+        const std::wstring &formula = formulas[i % formulas.size()];
+        begin = std::chrono::steady_clock::now();
+        sink += InterpreteExperssion(formula, bindings);
+        warm.Record(Nanoseconds(std::chrono::steady_clock::now() - begin));
+    }
+    Report("warm", warm);
+
+    std::vector<char> sweep(quick ? 1 << 20 : 64 << 20);
+    Histogram cold;
+    for(size_t i = 0; i < coldCalls; ++i) {
+        for(size_t offset = 0; offset < sweep.size(); offset += 64) ++sweep[offset];
+        const std::wstring &formula = formulas[i % formulas.size()];
+        begin = std::chrono::steady_clock::now();
+        sink += InterpreteExperssion(formula, bindings);
+        cold.Record(Nanoseconds(std::chrono::steady_clock::now() - begin));
+    }
+    Report("cold", cold);
+    // Keep the results alive so the calls are not optimized away.
+    return sink == -1.0 && sweep[0] == 1 ? 2 : 0;
+}
@@ -0,0 +1,38 @@
+#include "Generator.h"
+#include <cstdio>
+#include <cstring>
+
+// Write the canned corpora, one file of expressions per line each, to the directory given as
+// the last argument or the current one. With --quick the corpora are cut to a few short
+// expressions and every line is checked to evaluate.
+
+using namespace Interpreter;
+
+int main(int argc, char *argv[]) {
+    const bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+    const std::string directory = argc > (quick ? 2 : 1) ? argv[argc - 1] : ".";
+    for(auto corpus : Generator::CannedCorpora()) {
+        if(quick) {
+            corpus.m_name += "-quick";
+            corpus.m_options.m_tokens = std::min<size_t>(corpus.m_options.m_tokens, 1000);
+            corpus.m_count = std::min<size_t>(corpus.m_count, 10);
+        }
+        const std::string path = directory + "/" + corpus.m_name + ".txt";
+        try {
+            Generator::WriteCorpus(path, corpus.m_options, corpus.m_count);
+            if(quick) {
+                std::ifstream file(path);
+                const Bindings bindings{ { L"x", 1 }, { L"y", 2 }, { L"z", 3 } };
+                for(std::string line; std::getline(file, line);) InterpreteExperssion(std::wstring(line.begin(), line.end()), bindings);
+                file.close();
+                std::remove(path.c_str());
+            }
+        }
+        catch(const std::exception &error) {
+            std::printf("%s: %s\n", path.c_str(), error.what());
+            return 1;
+        }
+        std::printf("%-16s %10zu expressions of %10zu tokens\n", corpus.m_name.c_str(), corpus.m_count, corpus.m_options.m_tokens);
+    }
+    return 0;
+}
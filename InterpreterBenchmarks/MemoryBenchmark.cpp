@@ -0,0 +1,122 @@
+#include "Generator.h"
+#include "Serialization.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/resource.h>
+
+// Memory each representation of a formula keeps alive, per token, with the number of live
+// allocations it holds and the peak heap use while it is built. The interposed allocator
+// stores the size in front of every block to count bytes on release too.
+
+namespace {
+
+// The last bytes of the space in front of a block, which is as long as the alignment of the block.
+struct Header {
+    size_t m_size;
+    size_t m_offset;
+};
+
+std::atomic<size_t> liveBytes{ 0 };
+std::atomic<size_t> liveAllocations{ 0 };
+std::atomic<size_t> peakBytes{ 0 };
+
+// Addresses of headers are computed on integers, the compiler would take them for accesses
+// outside the object returned by new and for freeing a pointer new didn't return.
+void *Allocate(size_t size, size_t alignment) {
+    const size_t offset = std::max(alignment, sizeof(Header));
+    const size_t total = (offset + size + alignment - 1) / alignment * alignment;
+    void *block = alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, total) : std::malloc(total);
+    if(!block) throw std::bad_alloc();
+    const uintptr_t memory = reinterpret_cast<uintptr_t>(block) + offset;
+    const Header header{ size, offset };
+    std::memcpy(reinterpret_cast<void *>(memory - sizeof(Header)), &header, sizeof(header));
+    const size_t live = liveBytes.fetch_add(size) + size;
+    liveAllocations.fetch_add(1);
+    size_t peak = peakBytes.load();
+    while(live > peak && !peakBytes.compare_exchange_weak(peak, live)) {}
+    return reinterpret_cast<void *>(memory);
+}
+
+void Release(void *memory) {
+    if(!memory) return;
+    const uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+    Header header;
+    std::memcpy(&header, reinterpret_cast<const void *>(address - sizeof(Header)), sizeof(header));
+    liveBytes.fetch_sub(header.m_size);
+    liveAllocations.fetch_sub(1);
+    std::free(reinterpret_cast<void *>(address - header.m_offset));
+}
+} // namespace
+
+void *operator new(size_t size) {
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *memory) noexcept {
+    Release(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    Release(memory);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+    Release(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+    Release(memory);
+}
+
+using namespace Interpreter;
+
+namespace {
+
+// Build the representation, intermediate ones are released before measuring.
+template<typename F> void Report(const char *name, size_t tokens, F build) {
+    const size_t bytes = liveBytes.load(), allocations = liveAllocations.load();
+    peakBytes = bytes;
+    auto kept = build();
+    const size_t retained = liveBytes.load() - bytes;
+    std::printf("%-16s %10zu %12.1f %12zu %14zu\n", name, tokens, double(retained) / tokens, liveAllocations.load() - allocations, peakBytes.load() - bytes);
+}
+
+// Peak resident set of the process, in kilobytes on Linux.
+long PeakResidentKilobytes() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+    std::printf("%-16s %10s %12s %12s %14s\n", "representation", "tokens", "bytes/token", "allocations", "peak bytes");
+    for(size_t size : { 1000, 100000, 1000000 }) {
+        if(quick && size > 1000) break;
+        Generator::Options options;
+        options.m_tokens = size;
+        const std::wstring expression = Generator::ExpressionGenerator(options).Next();
+        const size_t tokens = Lexer::Tokenize(expression).size();
+
+        Report("expression", tokens, [&]() { return std::wstring(expression); });
+        Report("Tokenize", tokens, [&]() { return Lexer::Tokenize(expression); });
+        Report("MarkUnary", tokens, [&]() { return Lexer::MarkUnaryOperators(Lexer::Tokenize(expression)); });
+        Report("Parse", tokens, [&]() { return Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression))); });
+        Report("Ast", tokens, [&]() { return Ast::Build(Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression)))); });
+        Report("Program", tokens, [&]() { return Compiler::Compile(Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression)))); });
+        Report("Serialized", tokens, [&]() { return Serialization::Serialize(Compiler::Compile(Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression))))); });
+        std::printf("peak RSS after %zu tokens: %ld KB\n\n", tokens, PeakResidentKilobytes());
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "Cache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// Time per call of a constant expression interpreted every time, found in the result cache by
+// its text, and found by its canonical key under a text the cache hasn't seen. A hit has to
+// beat interpreting, otherwise the cache only costs memory. Normalizing for the canonical key
+// may cost more than interpreting a short expression, that lookup saves entries, not time.
+
+using namespace Interpreter;
+
+namespace {
+
+template<typename F> double NanosecondsPerCall(size_t calls, F call) {
+    double sink = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < calls; ++i) sink += call(i);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    // Use the results so the calls are not optimized away.
+    if(sink == -1.0) std::printf("\n");
+    return elapsed.count() / calls;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+    const size_t calls = quick ? 10000 : 1000000;
+    const std::wstring expression = L"(1+2)*3/7 - 4*(5-6)/8 + 9*0.25";
+    // Adding nothing keeps the value, so every spelling has the canonical key of the expression.
+    std::vector<std::wstring> spellings;
+    for(size_t i = 0; i < calls / 10; ++i) spellings.push_back(expression + L"+0*" + std::to_wstring(i));
+
+    Cache::ResultCache cache(spellings.size() + 1);
+    InterpreteExperssion(expression, cache);
+    const double interpreted = NanosecondsPerCall(calls, [&](size_t) { return InterpreteExperssion(expression); });
+    const double hit = NanosecondsPerCall(calls, [&](size_t) { return InterpreteExperssion(expression, cache); });
+    const double spelled = NanosecondsPerCall(spellings.size(), [&](size_t i) { return InterpreteExperssion(spellings[i]); });
+    const double canonical = NanosecondsPerCall(spellings.size(), [&](size_t i) { return InterpreteExperssion(spellings[i], cache); });
+
+    std::printf("%-20s %10s\n", "path", "ns/call");
+    std::printf("%-20s %10.0f\n", "interpreted", interpreted);
+    std::printf("%-20s %10.0f\n", "text hit", hit);
+    std::printf("%-20s %10.0f\n", "interpreted new text", spelled);
+    std::printf("%-20s %10.0f\n", "canonical hit", canonical);
+    std::printf("\na hit is %.1f times faster than interpreting\n", interpreted / hit);
+    if(cache.Misses() != 1) {
+        std::printf("unexpected misses: %zu\n", cache.Misses());
+        return 1;
+    }
+    return hit < interpreted ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "Generator.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+// Throughput of concurrent evaluation on 1 to N threads, N is the number of hardware threads
+// or --threads N. Every thread does the same amount of work, so with nothing shared the
+// throughput grows with the threads; efficiency is the throughput over threads times the one
+// thread throughput, and anything below 80% is flagged as sublinear.
+
+using namespace Interpreter;
+
+namespace {
+
+typedef std::function<double(size_t thread, size_t i)> Operation;
+
+struct Workload {
+    const char *m_name;
+    Operation m_operation;
+};
+
+double OperationsPerSecond(const Operation &operation, size_t threads, size_t operations) {
+    std::atomic<bool> start{ false };
+    std::vector<double> sums(threads);
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            while(!start.load()) std::this_thread::yield();
+            double sum = 0;
+            for(size_t i = 0; i < operations; ++i) sum += operation(t, i);
+            sums[t] = sum;
+        });
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start = true;
+    for(auto &worker : workers) worker.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return threads * operations / elapsed.count();
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    bool quick = false;
+    const size_t hardwareThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    size_t maxThreads = hardwareThreads;
+    for(int i = 1; i < argc; ++i) {
+        if(std::strcmp(argv[i], "--quick") == 0) quick = true;
+        else if(std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) maxThreads = std::max(std::atoi(argv[++i]), 1);
+    }
+    const size_t operations = quick ? 200 : 20000;
+    if(quick) maxThreads = std::min<size_t>(maxThreads, 4);
+
+    Generator::Options options;
+    options.m_tokens = 30;
+    Generator::ExpressionGenerator generator(options);
+    std::vector<std::wstring> formulas;
+    for(size_t i = 0; i < 1024; ++i) formulas.push_back(generator.Next());
+    const Bindings bindings{ { L"x", 0.5 }, { L"y", 2 }, { L"z", -3 } };
+    const Tokens marked = Lexer::MarkUnaryOperators(Lexer::Tokenize(formulas[0]));
+    const Tokens shared = Parser::Parse(marked);
+
+    const std::vector<Workload> workloads = {
+        { "same formula", [&](size_t, size_t) { return InterpreteExperssion(formulas[0], bindings); } },
+        { "different formulas", [&](size_t t, size_t i) { return InterpreteExperssion(formulas[(t * 131 + i) % formulas.size()], bindings); } },
+        // Every thread reads the same tokens and copies their shared pointers.
+        { "shared Tokens parse", [&](size_t, size_t) { return double(Parser::Parse(marked).size()); } },
+        { "shared Tokens evaluate", [&](size_t, size_t) { return Evaluator::Evaluate(shared, bindings); } },
+    };
+
+    std::vector<size_t> counts;
+    for(size_t threads = 1; threads < maxThreads; threads *= 2) counts.push_back(threads);
+    counts.push_back(maxThreads);
+
+    size_t flagged = 0;
+    std::printf("%-24s %8s %14s %11s\n", "workload", "threads", "ops/s", "efficiency");
+    for(const auto &workload : workloads) {
+        double single = 0;
+        for(size_t threads : counts) {
+            const double rate = OperationsPerSecond(workload.m_operation, threads, operations);
+            if(threads == 1) single = rate;
+            const double efficiency = rate / (threads * single);
+            // More threads than the hardware runs at once can't scale, so they are not flagged.
+            const bool oversubscribed = threads > hardwareThreads;
+            const bool sublinear = !oversubscribed && efficiency < 0.8;
+            flagged += sublinear;
+            std::printf("%-24s %8zu %14.0f %10.0f%%%s\n", workload.m_name, threads, rate, efficiency * 100, sublinear ? "  SUBLINEAR" : oversubscribed ? "  oversubscribed" : "");
+        }
+    }
+    if(flagged) std::printf("\n%zu runs scale sublinearly, look for shared state on their path.\n", flagged);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "Interpreter.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Time of each stage of the interpreter on its own, per token and per operation, with the
+// number of heap allocations an operation makes. The baseline for any performance change.
+
+namespace {
+
+std::atomic<size_t> allocations{ 0 };
+} // namespace
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void *memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    std::free(memory);
+}
+
+using namespace Interpreter;
+
+namespace {
+
+// Sum of terms with nested parentheses, unary minus, every operator and one variable.
+std::wstring MakeExpression(size_t tokens) {
+    static const wchar_t *const terms[] = { L"1.5*x", L"(2-x)/3", L"-4+x", L"x*(x-0.5)", L"7/-x" };
+    std::wstring expression = L"1";
+    for(size_t i = 0, count = 1; count < tokens; ++i) {
+        expression += i % 2 ? L"+" : L"-";
+        expression += terms[i % 5];
+        count += 1 + Lexer::Tokenize(terms[i % 5]).size();
+    }
+    return expression;
+}
+
+struct Measure {
+    double m_seconds;
+    size_t m_allocations;
+};
+
+// Repeat the operation until it took long enough to time, at least once.
+template<typename F> Measure PerOperation(F operation, double minSeconds) {
+    size_t repeats = 0;
+    const size_t before = allocations.load();
+    auto begin = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed(0);
+    do {
+        operation();
+        ++repeats;
+        elapsed = std::chrono::steady_clock::now() - begin;
+    } while(elapsed.count() < minSeconds);
+    return { elapsed.count() / repeats, (allocations.load() - before) / repeats };
+}
+
+void Report(const char *stage, size_t tokens, const Measure &measure) {
+    std::printf("%-22s %10zu %12.2f %14.0f %12zu\n", stage, tokens, measure.m_seconds * 1e9 / tokens, tokens / measure.m_seconds, measure.m_allocations);
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+    const double minSeconds = quick ? 0.001 : 0.5;
+    const Bindings bindings{ { L"x", 0.25 } };
+    double sink = 0;
+
+    std::printf("%-22s %10s %12s %14s %12s\n", "stage", "tokens", "ns/token", "tokens/s", "allocs/op");
+    for(size_t size : { 10, 100, 1000, 10000, 100000 }) {
+        if(quick && size > 1000) break;
+        const std::wstring expression = MakeExpression(size);
+        const Tokens tokens = Lexer::Tokenize(expression);
+        const Tokens marked = Lexer::MarkUnaryOperators(tokens);
+        const Tokens postfix = Parser::Parse(marked);
+        const size_t count = tokens.size();
+
+        Report("Tokenize", count, PerOperation([&]() { sink += Lexer::Tokenize(expression).size(); }, minSeconds));
+        Report("MarkUnaryOperators", count, PerOperation([&]() { sink += Lexer::MarkUnaryOperators(tokens).size(); }, minSeconds));
+        Report("Parse", count, PerOperation([&]() { sink += Parser::Parse(marked).size(); }, minSeconds));
+        Report("Evaluate", count, PerOperation([&]() { sink += Evaluator::Evaluate(postfix, bindings); }, minSeconds));
+        Report("InterpreteExperssion", count, PerOperation([&]() { sink += InterpreteExperssion(expression, bindings); }, minSeconds));
+        if(InterpreteExperssion(expression, bindings) != Evaluator::Evaluate(postfix, bindings)) {
+            std::printf("stages disagree for %zu tokens\n", count);
+            return 1;
+        }
+    }
+    // Keep the results alive so the stages are not optimized away.
+    return sink == -1.0 ? 2 : 0;
+}
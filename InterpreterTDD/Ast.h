@@ -0,0 +1,239 @@
+#pragma once
+#include "Interpreter.h"
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace Interpreter {
+namespace Ast {
+
+struct Node;
+typedef std::shared_ptr<const Node> NodePtr;
+typedef std::vector<NodePtr> Nodes;
+
+// Expression tree node labeled with the postfix token that produces its value from the arguments.
+struct Node {
+    Node(Token token, Nodes args) : m_token(std::move(token)), m_args(std::move(args)) {}
+    ~Node();
+
+    Token m_token;
+    Nodes m_args;
+};
+
+// Release long chains without recursion, a generated sum of many terms is as deep as it is long.
+inline Node::~Node() {
+    Nodes pending(std::move(m_args));
+    while(!pending.empty()) {
+        NodePtr node = std::move(pending.back());
+        pending.pop_back();
+        if(node.use_count() == 1) {
+            Nodes &args = const_cast<Node &>(*node).m_args;
+            std::move(args.begin(), args.end(), std::back_inserter(pending));
+            args.clear();
+        }
+    }
+}
+
+inline NodePtr MakeNode(Token token, Nodes args = {}) {
+    return std::make_shared<Node>(std::move(token), std::move(args));
+}
+
+template<typename T> NodePtr MakeLeaf(T value) {
+    return MakeNode(MakeToken(value));
+}
+
+inline size_t ArityOf(Operator op) {
+    switch(op) {
+        case Operator::Plus:
+        case Operator::Minus:
+        case Operator::Mul:
+        case Operator::Div:
+            return 2;
+        case Operator::UPlus:
+        case Operator::UMinus:
+            return 1;
+        case Operator::FusedMulAdd:
+            return 3;
+        default:
+            throw std::logic_error("Operator can't be evaluated.");
+    }
+}
+
+inline const double *NumberOf(const NodePtr &node) {
+    return PayloadOf<double>(node->m_token);
+}
+
+inline bool IsNumber(const NodePtr &node) {
+    return NumberOf(node) != nullptr;
+}
+
+inline const Variable *VariableOf(const NodePtr &node) {
+    return PayloadOf<Variable>(node->m_token);
+}
+
+// Tokens are equal and numbers also have the same sign, so 0 and -0 are never mixed up.
+inline bool Identical(const Token &left, const Token &right) {
+    if(!(left == right)) return false;
+    const double *num = PayloadOf<double>(left);
+    return !num || std::signbit(*num) == std::signbit(*PayloadOf<double>(right));
+}
+
+// Reuse the node when all arguments are the same to keep untouched subtrees shared.
+inline NodePtr Rebuild(const NodePtr &node, Nodes args) {
+    if(std::equal(args.cbegin(), args.cend(), node->m_args.cbegin(), node->m_args.cend())) return node;
+    return MakeNode(node->m_token, std::move(args));
+}
+
+namespace Detail {
+
+class TreeBuilder : public TokenVisitor {
+public:
+    NodePtr Result() const {
+        return m_stack.empty() ? nullptr : m_stack.back();
+    }
+
+private:
+    void Visit(double num) override {
+        m_stack.push_back(MakeLeaf(num));
+    }
+
+    void Visit(const Variable &variable) override {
+        m_stack.push_back(MakeLeaf(variable));
+    }
+
+    void Visit(Operator op) override {
+        const size_t arity = ArityOf(op);
+        if(m_stack.size() < arity) throw std::logic_error("Not enough arguments in stack.");
+        Nodes args(std::make_move_iterator(m_stack.end() - arity), std::make_move_iterator(m_stack.end()));
+        m_stack.erase(m_stack.end() - arity, m_stack.end());
+        m_stack.push_back(MakeNode(MakeToken(op), std::move(args)));
+    }
+
+    Nodes m_stack;
+};
+} // namespace Detail
+
+// Convert the sequence of tokens in postfix notation to an expression tree, nullptr for an empty sequence.
+inline NodePtr Build(const Tokens &tokens) {
+    Detail::TreeBuilder builder;
+    builder.VisitAll(tokens.cbegin(), tokens.cend());
+    return builder.Result();
+}
+
+// Rebuild the tree bottom-up: rewrite(node, args) gets the original node with already rewritten arguments.
+// Every distinct node is rewritten once, so shared subtrees stay shared.
+template<typename F> NodePtr Transform(const NodePtr &root, F rewrite) {
+    if(!root) return root;
+    std::unordered_map<const Node *, NodePtr> done;
+    std::vector<std::pair<const NodePtr *, bool>> pending{ { &root, false } };
+    while(!pending.empty()) {
+        const NodePtr &node = *pending.back().first;
+        if(pending.back().second) {
+            pending.pop_back();
+            Nodes args;
+            args.reserve(node->m_args.size());
+            for(const auto &arg : node->m_args) args.push_back(done.at(arg.get()));
+            done.emplace(node.get(), rewrite(node, std::move(args)));
+        }
+        else if(done.count(node.get())) {
+            pending.pop_back();
+        }
+        else {
+            pending.back().second = true;
+            for(auto arg = node->m_args.crbegin(); arg != node->m_args.crend(); ++arg) pending.emplace_back(&*arg, false);
+        }
+    }
+    return done.at(root.get());
+}
+
+// Number of distinct nodes, what a program computes after common subexpressions are shared.
+inline size_t CountNodes(const NodePtr &root) {
+    std::unordered_set<const Node *> seen;
+    std::vector<const Node *> pending;
+    if(root) pending.push_back(root.get());
+    while(!pending.empty()) {
+        const Node *node = pending.back();
+        pending.pop_back();
+        if(!seen.insert(node).second) continue;
+        for(const auto &arg : node->m_args) pending.push_back(arg.get());
+    }
+    return seen.size();
+}
+
+// Compare trees by structure, shared nodes are equal without looking inside.
+inline bool Equal(const NodePtr &left, const NodePtr &right) {
+    std::vector<std::pair<const Node *, const Node *>> pending{ { left.get(), right.get() } };
+    while(!pending.empty()) {
+        auto pair = pending.back();
+        pending.pop_back();
+        if(pair.first == pair.second) continue;
+        if(!pair.first || !pair.second) return false;
+        if(!Identical(pair.first->m_token, pair.second->m_token)) return false;
+        if(pair.first->m_args.size() != pair.second->m_args.size()) return false;
+        for(size_t i = 0; i < pair.first->m_args.size(); ++i) {
+            pending.emplace_back(pair.first->m_args[i].get(), pair.second->m_args[i].get());
+        }
+    }
+    return true;
+}
+
+// Convert the expression tree back to the sequence of tokens in postfix notation.
+inline Tokens ToPostfix(const NodePtr &root) {
+    Tokens result;
+    if(!root) return result;
+    std::vector<std::pair<const Node *, size_t>> pending{ { root.get(), 0 } };
+    while(!pending.empty()) {
+        auto &top = pending.back();
+        if(top.second < top.first->m_args.size()) {
+            const Node *arg = top.first->m_args[top.second++].get();
+            pending.emplace_back(arg, 0);
+        }
+        else {
+            result.push_back(top.first->m_token);
+            pending.pop_back();
+        }
+    }
+    return result;
+}
+namespace Detail {
+
+class SubtreeInterner {
+public:
+    explicit SubtreeInterner(bool shareNumbers) : m_shareNumbers(shareNumbers) {}
+
+    NodePtr operator()(const NodePtr &node, Nodes args) {
+        if(!m_shareNumbers && IsNumber(node)) return node;
+        size_t hash = node->m_token->Hash();
+        for(const auto &arg : args) hash = hash * 31 + std::hash<const Node *>()(arg.get());
+        Nodes &candidates = m_table[hash];
+        for(const auto &candidate : candidates) {
+            if(Identical(candidate->m_token, node->m_token) && candidate->m_args == args) return candidate;
+        }
+        candidates.push_back(Rebuild(node, std::move(args)));
+        return candidates.back();
+    }
+
+private:
+    bool m_shareNumbers;
+    std::unordered_map<size_t, Nodes> m_table;
+};
+} // namespace Detail
+
+// Convert the tree to a directed acyclic graph where equal subtrees are the same node.
+// Without sharing numbers every literal stays a distinct leaf, and so do the subtrees holding it.
+inline NodePtr ShareCommonSubtrees(const NodePtr &root, bool shareNumbers = true) {
+    Detail::SubtreeInterner interner(shareNumbers);
+    return Transform(root, std::ref(interner));
+}
+
+// Share equal subtrees within and across the trees.
+inline Nodes ShareCommonSubtrees(const Nodes &roots) {
+    Detail::SubtreeInterner interner(true);
+    Nodes result;
+    result.reserve(roots.size());
+    for(const auto &root : roots) result.push_back(Transform(root, std::ref(interner)));
+    return result;
+}
+} // namespace Ast
+} // namespace Interpreter
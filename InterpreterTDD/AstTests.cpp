@@ -0,0 +1,68 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Ast.h"
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(AstTests) {
+public:
+    TEST_METHOD(Should_build_nothing_from_empty_list) {
+        Assert::IsTrue(Ast::Build({}) == nullptr);
+    }
+
+    TEST_METHOD(Should_build_tree_with_operator_in_root) {
+        Ast::NodePtr root = Ast::Build({ _1, _2, plus });
+        Assert::AreEqual(plus, root->m_token);
+        Assert::AreEqual(size_t(2), root->m_args.size());
+        Assert::AreEqual(_1, root->m_args[0]->m_token);
+        Assert::AreEqual(_2, root->m_args[1]->m_token);
+    }
+
+    TEST_METHOD(Should_convert_tree_back_to_same_postfix_sequence) {
+        auto tokens = { _4, _1, plus, _2, mul, _4, _3, _1, minus, div, uMinus, div };
+        Tokens result = Ast::ToPostfix(Ast::Build(tokens));
+        AssertRange::AreEqual(tokens, result);
+    }
+
+    TEST_METHOD(Should_throw_when_not_enough_arguments) {
+        Assert::ExpectException<std::logic_error>([]() { Ast::Build({ _1, plus }); });
+    }
+
+    TEST_METHOD(Should_build_and_release_very_long_chain) {
+        Tokens tokens{ _1 };
+        for(int i = 0; i < 100000; ++i) {
+            tokens.push_back(_1);
+            tokens.push_back(plus);
+        }
+        Assert::AreEqual(tokens.size(), Ast::ToPostfix(Ast::Build(tokens)).size());
+    }
+
+    TEST_METHOD(Should_keep_unchanged_subtrees_when_transform) {
+        Ast::NodePtr root = Ast::Build({ _1, _2, plus, _3, mul });
+        Ast::NodePtr result = Ast::Transform(root, Ast::Rebuild);
+        Assert::IsTrue(root == result);
+    }
+};
+
+TEST_CLASS(CommonSubtreesTests) {
+public:
+    TEST_METHOD(Should_share_equal_subtrees) {
+        // (a+b)*(a+b)
+        Ast::NodePtr root = Ast::ShareCommonSubtrees(Ast::Build({ a, b, plus, a, b, plus, mul }));
+        Assert::IsTrue(root->m_args[0] == root->m_args[1]);
+    }
+
+    TEST_METHOD(Should_not_share_different_subtrees) {
+        // (a+b)*(b+a)
+        Ast::NodePtr root = Ast::ShareCommonSubtrees(Ast::Build({ a, b, plus, b, a, plus, mul }));
+        Assert::IsTrue(root->m_args[0] != root->m_args[1]);
+    }
+
+    TEST_METHOD(Should_not_share_zeros_of_different_sign) {
+        Ast::NodePtr root = Ast::ShareCommonSubtrees(Ast::MakeNode(plus, { Ast::MakeLeaf(0.0), Ast::MakeLeaf(-0.0) }));
+        Assert::IsTrue(root->m_args[0] != root->m_args[1]);
+    }
+};
+
+}
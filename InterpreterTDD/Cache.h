@@ -0,0 +1,915 @@
+#pragma once
+#include "Canonical.h"
+#include "Epoch.h"
+#include "Serialization.h"
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+namespace Interpreter {
+namespace Cache {
+
+typedef std::shared_ptr<const Compiler::Program> ProgramPtr;
+
+// Approximate heap memory of a key string held by a cache.
+inline size_t BytesOf(const std::wstring &key) {
+    return sizeof(key) + (key.size() + 1) * sizeof(wchar_t);
+}
+
+// Approximate heap memory of the program.
+inline size_t BytesOf(const Compiler::Program &program) {
+    size_t bytes = sizeof(Compiler::Program);
+    bytes += program.Code().size() * sizeof(Compiler::Instruction) + program.Constants().size() * sizeof(double);
+    for(const auto &name : program.Variables()) bytes += BytesOf(name);
+    return bytes;
+}
+
+// Approximate heap memory of the program and of the key it is cached under.
+inline size_t BytesOf(const std::wstring &expression, const Compiler::Program &program) {
+    return BytesOf(expression) + BytesOf(program);
+}
+
+namespace Detail {
+
+inline Tokens ParseExpression(const std::wstring &expression) {
+    return Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression)));
+}
+
+inline ProgramPtr CompileTokens(const Tokens &tokens, const Optimizer::Options &options) {
+    return std::make_shared<const Compiler::Program>(Compiler::Compile(tokens, options));
+}
+
+inline ProgramPtr CompileExpression(const std::wstring &expression, const Optimizer::Options &options) {
+    return CompileTokens(ParseExpression(expression), options);
+}
+} // namespace Detail
+
+struct Limits {
+    size_t m_entries = 1024;
+    size_t m_bytes = 16 << 20;
+};
+
+// Compiled programs by expression text, the least recently used are evicted first
+// when either limit is exceeded. A program larger than the byte limit is never cached.
+// When the text misses, the expression is looked up by its canonical key, and a program
+// found that way is shared by the new text, so a+b and b+a or x*1 and x compile once.
+class ProgramCache {
+public:
+    explicit ProgramCache(Limits limits = {}, Optimizer::Options options = {}) : m_limits(limits), m_options(options) {}
+
+    ProgramPtr Get(const std::wstring &expression) {
+        auto found = m_index.find(expression);
+        if(found != m_index.end()) {
+            ++m_hits;
+            m_entries.splice(m_entries.begin(), m_entries, found->second);
+            return found->second->m_program;
+        }
+        const Tokens tokens = Detail::ParseExpression(expression);
+        if(m_limits.m_entries == 0) {
+            ++m_misses;
+            return Detail::CompileTokens(tokens, m_options);
+        }
+        Canonical::Key key = Canonical::KeyOf(tokens);
+        auto same = m_canonical.find(key);
+        if(same != m_canonical.end()) {
+            ++m_hits;
+            m_entries.splice(m_entries.begin(), m_entries, same->second);
+            ProgramPtr program = same->second->m_program;
+            Alias(expression, same->second);
+            return program;
+        }
+        ++m_misses;
+        ProgramPtr program = Detail::CompileTokens(tokens, m_options);
+        const size_t bytes = BytesOf(*program) + BytesOf(key.m_text);
+        if(bytes + BytesOf(expression) > m_limits.m_bytes) return program;
+        m_entries.push_front({ nullptr, {}, program, bytes });
+        m_entries.front().m_key = &m_canonical.emplace(std::move(key), m_entries.begin()).first->first;
+        m_bytes += bytes;
+        Alias(expression, m_entries.begin());
+        return program;
+    }
+
+    void Clear() {
+        m_index.clear();
+        m_canonical.clear();
+        m_entries.clear();
+        m_bytes = 0;
+    }
+
+    size_t Size() const {
+        return m_entries.size();
+    }
+
+    size_t Bytes() const {
+        return m_bytes;
+    }
+
+    size_t Hits() const {
+        return m_hits;
+    }
+
+    size_t Misses() const {
+        return m_misses;
+    }
+
+    size_t Evictions() const {
+        return m_evictions;
+    }
+
+private:
+    // Keys are stored once, in the maps, and the entry points to them to remove them on eviction.
+    struct Entry {
+        const Canonical::Key *m_key;
+        std::vector<const std::wstring *> m_texts;
+        ProgramPtr m_program;
+        size_t m_bytes;
+    };
+
+    void Alias(const std::wstring &expression, std::list<Entry>::iterator entry) {
+        entry->m_texts.push_back(&m_index.emplace(expression, entry).first->first);
+        const size_t bytes = BytesOf(expression) + sizeof(const std::wstring *);
+        entry->m_bytes += bytes;
+        m_bytes += bytes;
+        EvictOverLimits();
+    }
+
+    void EvictOverLimits() {
+        while(m_entries.size() > m_limits.m_entries || m_bytes > m_limits.m_bytes) {
+            const Entry &last = m_entries.back();
+            m_bytes -= last.m_bytes;
+            for(auto text : last.m_texts) m_index.erase(m_index.find(*text));
+            m_canonical.erase(m_canonical.find(*last.m_key));
+            m_entries.pop_back();
+            ++m_evictions;
+        }
+    }
+
+    Limits m_limits;
+    Optimizer::Options m_options;
+    std::list<Entry> m_entries;
+    std::unordered_map<std::wstring, std::list<Entry>::iterator> m_index;
+    std::unordered_map<Canonical::Key, std::list<Entry>::iterator, Canonical::KeyHash> m_canonical;
+    size_t m_bytes = 0;
+    size_t m_hits = 0, m_misses = 0, m_evictions = 0;
+};
+
+// Thread-safe cache split into shards by hash of the text, the limits hold for the whole
+// cache. A hit takes no lock: each shard publishes its index as an immutable snapshot behind
+// an atomic pointer, and a miss copies the index of its shard under the shard lock, adds the
+// program and publishes the copy. Replaced snapshots and evicted programs are freed through
+// epochs once no reader can see them, so readers get the program itself without counting
+// references to it. A hit only sets the reference bit of the entry, and eviction follows the
+// CLOCK hand of one shard after the other until the cache is within its limits again. When the
+// text misses, the canonical key is looked up among the programs still cached, under a lock of
+// its own, and a program found that way is shared by the new text.
+class ShardedProgramCache {
+public:
+    class Reader;
+
+    explicit ShardedProgramCache(Limits limits = {}, size_t shards = 16, Optimizer::Options options = {})
+        : m_limits(limits), m_shards(std::max<size_t>(shards, 1)), m_options(options) {}
+
+    ShardedProgramCache(const ShardedProgramCache &) = delete;
+    ShardedProgramCache &operator=(const ShardedProgramCache &) = delete;
+
+    // Readers must be gone.
+    ~ShardedProgramCache() {
+        for(auto &shard : m_shards) {
+            delete shard.m_index.load();
+            for(const Entry *entry : shard.m_slots) delete entry;
+        }
+    }
+
+    size_t Size() const {
+        return m_size.load();
+    }
+
+    size_t Bytes() const {
+        return m_bytes.load();
+    }
+
+    // Hits of the readers, each counts its own and they are added up here.
+    size_t Hits() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t hits = m_hits;
+        for(const auto &counter : m_counters) hits += counter.m_hits.load(std::memory_order_relaxed);
+        return hits;
+    }
+
+    size_t Misses() const {
+        return m_misses.load();
+    }
+
+    size_t Evictions() const {
+        return m_evictions.load();
+    }
+
+private:
+    // Each entry counts its program in full even when it is shared, so the limits hold whichever goes first.
+    struct Entry {
+        Entry(const std::wstring &expression, ProgramPtr program, size_t bytes)
+            : m_expression(expression), m_program(std::move(program)), m_bytes(bytes), m_referenced(false) {}
+
+        // Set the bit only when it is clear, so hits don't keep writing the line of the entry.
+        void Reference() const {
+            if(!m_referenced.load(std::memory_order_relaxed)) m_referenced.store(true, std::memory_order_relaxed);
+        }
+
+        std::wstring m_expression;
+        ProgramPtr m_program;
+        size_t m_bytes;
+        mutable std::atomic<bool> m_referenced;
+    };
+
+    // Keys point into the text of the entries, which outlive every snapshot they are in.
+    typedef std::unordered_map<std::wstring_view, const Entry *> Index;
+
+    // Aligned to keep the index pointers of neighbour shards off the same cache line.
+    struct alignas(64) Shard {
+        std::atomic<const Index *> m_index{ new Index() };
+        std::mutex m_mutex;
+        std::vector<Entry *> m_slots;
+        size_t m_hand = 0;
+    };
+
+    // Hits of one reader, on a line of its own.
+    struct alignas(64) Counter {
+        std::atomic<size_t> m_hits{ 0 };
+    };
+
+    Shard &ShardOf(std::wstring_view expression) {
+        return m_shards[std::hash<std::wstring_view>()(expression) % m_shards.size()];
+    }
+
+    bool OverLimits() const {
+        return m_size.load() > m_limits.m_entries || m_bytes.load() > m_limits.m_bytes;
+    }
+
+    // Add the program unless another reader did first, the entry is valid while the caller is in its epoch.
+    const Entry &Insert(Shard &shard, const std::wstring &expression, ProgramPtr program, size_t bytes) {
+        const Entry *entry = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            const Index *current = shard.m_index.load();
+            auto found = current->find(expression);
+            if(found != current->end()) return *found->second;
+            std::unique_ptr<Index> next(new Index(*current));
+            shard.m_slots.push_back(new Entry(expression, std::move(program), bytes));
+            entry = shard.m_slots.back();
+            next->emplace(entry->m_expression, entry);
+            m_size += 1;
+            m_bytes += bytes;
+            Publish(shard, next.release(), {});
+        }
+        EvictOverLimits();
+        m_domain.Collect();
+        return *entry;
+    }
+
+    // Program cached under another text with the same canonical key, nullptr when there is none.
+    ProgramPtr Known(const Canonical::Key &key) {
+        std::lock_guard<std::mutex> lock(m_canonicalMutex);
+        auto found = m_canonical.find(key);
+        return found == m_canonical.end() ? nullptr : found->second.lock();
+    }
+
+    // Remember the program under its canonical key, or return the one another reader compiled first.
+    ProgramPtr Share(Canonical::Key key, ProgramPtr program) {
+        std::lock_guard<std::mutex> lock(m_canonicalMutex);
+        std::weak_ptr<const Compiler::Program> &known = m_canonical[std::move(key)];
+        if(ProgramPtr first = known.lock()) return first;
+        known = program;
+        // Programs of evicted entries leave expired keys behind, drop them once they outnumber the entries.
+        if(m_canonical.size() > 2 * m_size.load() + 16) {
+            for(auto item = m_canonical.begin(); item != m_canonical.end();) {
+                if(item->second.expired()) item = m_canonical.erase(item);
+                else ++item;
+            }
+        }
+        return program;
+    }
+
+    // Swap in the index, then retire the old one and the entries it no longer holds.
+    void Publish(Shard &shard, const Index *index, const std::vector<const Entry *> &evicted) {
+        m_domain.Retire(shard.m_index.exchange(index));
+        for(const Entry *entry : evicted) m_domain.Retire(entry);
+    }
+
+    // One entry per shard in turn, those referenced since the hand of their shard last passed get a second chance.
+    void EvictOverLimits() {
+        for(size_t empty = 0; OverLimits() && empty < m_shards.size();) {
+            Shard &shard = m_shards[m_victim++ % m_shards.size()];
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            if(shard.m_slots.empty() || !OverLimits()) {
+                empty += shard.m_slots.empty();
+                continue;
+            }
+            empty = 0;
+            for(;; ++shard.m_hand) {
+                if(shard.m_hand >= shard.m_slots.size()) shard.m_hand = 0;
+                if(!shard.m_slots[shard.m_hand]->m_referenced.exchange(false, std::memory_order_relaxed)) break;
+            }
+            const Entry *entry = shard.m_slots[shard.m_hand];
+            std::swap(shard.m_slots[shard.m_hand], shard.m_slots.back());
+            shard.m_slots.pop_back();
+            std::unique_ptr<Index> next(new Index(*shard.m_index.load()));
+            next->erase(entry->m_expression);
+            m_size -= 1;
+            m_bytes -= entry->m_bytes;
+            ++m_evictions;
+            Publish(shard, next.release(), { entry });
+        }
+    }
+
+    Counter &Register() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_counters.emplace_back();
+        return m_counters.back();
+    }
+
+    void Unregister(Counter &counter) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_hits += counter.m_hits.load(std::memory_order_relaxed);
+        m_counters.remove_if([&counter](const Counter &candidate) { return &candidate == &counter; });
+    }
+
+    Limits m_limits;
+    std::vector<Shard> m_shards;
+    Optimizer::Options m_options;
+    Epoch::Domain m_domain;
+    std::atomic<size_t> m_size{ 0 }, m_bytes{ 0 };
+    std::atomic<size_t> m_misses{ 0 }, m_evictions{ 0 }, m_victim{ 0 };
+    mutable std::mutex m_mutex;
+    std::list<Counter> m_counters;
+    size_t m_hits = 0;
+    std::mutex m_canonicalMutex;
+    std::unordered_map<Canonical::Key, std::weak_ptr<const Compiler::Program>, Canonical::KeyHash> m_canonical;
+};
+
+// Looks programs up in the cache on one thread, in working memory of its own. Creating and
+// destroying a reader takes a lock of the cache, a hit never does.
+class ShardedProgramCache::Reader {
+public:
+    explicit Reader(ShardedProgramCache &cache) : m_cache(cache), m_epoch(cache.m_domain), m_counter(cache.Register()) {}
+
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    ~Reader() {
+        m_cache.Unregister(m_counter);
+    }
+
+    // Call read(program) with the program of the expression, which stays alive until read returns
+    // even when it is evicted meanwhile. A miss compiles the expression before taking any lock of
+    // a shard.
+    template<typename F> auto Read(const std::wstring &expression, F read) -> decltype(read(std::declval<const Compiler::Program &>())) {
+        return m_epoch.Read([this, &expression, &read]() -> decltype(read(std::declval<const Compiler::Program &>())) {
+            Shard &shard = m_cache.ShardOf(expression);
+            const Index &index = *shard.m_index.load();
+            auto found = index.find(expression);
+            if(found != index.end()) {
+                CountHit();
+                found->second->Reference();
+                return read(*found->second->m_program);
+            }
+            const Tokens tokens = Detail::ParseExpression(expression);
+            if(m_cache.m_limits.m_entries == 0) {
+                ++m_cache.m_misses;
+                return read(Compiler::Compile(tokens, m_cache.m_options));
+            }
+            Canonical::Key key = Canonical::KeyOf(tokens);
+            ProgramPtr program = m_cache.Known(key);
+            if(program) CountHit();
+            else {
+                ++m_cache.m_misses;
+                program = m_cache.Share(std::move(key), Detail::CompileTokens(tokens, m_cache.m_options));
+            }
+            const size_t bytes = BytesOf(expression, *program);
+            if(bytes > m_cache.m_limits.m_bytes) return read(*program);
+            return read(*m_cache.Insert(shard, expression, std::move(program), bytes).m_program);
+        });
+    }
+
+    double Evaluate(const std::wstring &expression, const Bindings &bindings = {}) {
+        return Read(expression, [this, &bindings](const Compiler::Program &program) { return program.Evaluate(bindings, m_scratch); });
+    }
+
+private:
+    void CountHit() {
+        m_counter.m_hits.store(m_counter.m_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    ShardedProgramCache &m_cache;
+    Epoch::Reader m_epoch;
+    Counter &m_counter;
+    Compiler::Scratch m_scratch;
+};
+
+// Values of expressions without variables. The text of the expression is looked up first,
+// so a hit skips even tokenizing. On a miss the canonical key of the expression is looked up,
+// and a value found that way is shared by the new text, so spacing, spelling of numbers and
+// equivalent forms such as (1+2) and 1+2 are evaluated once. Once the limit of texts is
+// reached the least recently used value is evicted with all its texts, a disabled cache
+// stores nothing. The cache is not thread-safe, keep one per thread.
+class ResultCache {
+public:
+    explicit ResultCache(size_t limit = 4096) : m_limit(limit) {}
+
+    double Evaluate(const std::wstring &expression, const Bindings &bindings = {}) {
+        if(m_enabled) {
+            auto found = m_index.find(expression);
+            if(found != m_index.end()) {
+                ++m_hits;
+                m_entries.splice(m_entries.begin(), m_entries, found->second);
+                return found->second->m_value;
+            }
+        }
+        const Tokens tokens = Lexer::MarkUnaryOperators(Lexer::Tokenize(expression));
+        const bool constant = std::none_of(tokens.cbegin(), tokens.cend(), [](const Token &token) { return PayloadOf<Variable>(token) != nullptr; });
+        if(!m_enabled || !constant) return Evaluator::Evaluate(Parser::Parse(tokens), bindings);
+        const Tokens postfix = Parser::Parse(tokens);
+        Canonical::Key key = Canonical::KeyOf(postfix);
+        auto same = m_canonical.find(key);
+        if(same != m_canonical.end()) {
+            ++m_hits;
+            m_entries.splice(m_entries.begin(), m_entries, same->second);
+            const double value = same->second->m_value;
+            Alias(expression, same->second);
+            return value;
+        }
+        ++m_misses;
+        const double value = Evaluator::Evaluate(postfix);
+        if(m_limit == 0) return value;
+        m_entries.push_front({ nullptr, {}, value });
+        m_entries.front().m_key = &m_canonical.emplace(std::move(key), m_entries.begin()).first->first;
+        Alias(expression, m_entries.begin());
+        return value;
+    }
+
+    void SetEnabled(bool enabled) {
+        m_enabled = enabled;
+        if(!enabled) Clear();
+    }
+
+    bool Enabled() const {
+        return m_enabled;
+    }
+
+    void Clear() {
+        m_index.clear();
+        m_canonical.clear();
+        m_entries.clear();
+    }
+
+    size_t Size() const {
+        return m_entries.size();
+    }
+
+    size_t Hits() const {
+        return m_hits;
+    }
+
+    size_t Misses() const {
+        return m_misses;
+    }
+
+    size_t Evictions() const {
+        return m_evictions;
+    }
+
+private:
+    // Keys are stored once, in the maps, and the entry points to them to remove them on eviction.
+    struct Entry {
+        const Canonical::Key *m_key;
+        std::vector<const std::wstring *> m_texts;
+        double m_value;
+    };
+
+    void Alias(const std::wstring &expression, std::list<Entry>::iterator entry) {
+        entry->m_texts.push_back(&m_index.emplace(expression, entry).first->first);
+        while(m_index.size() > m_limit) {
+            const Entry &last = m_entries.back();
+            for(auto text : last.m_texts) m_index.erase(m_index.find(*text));
+            m_canonical.erase(m_canonical.find(*last.m_key));
+            m_entries.pop_back();
+            ++m_evictions;
+        }
+    }
+
+    size_t m_limit;
+    bool m_enabled = true;
+    std::list<Entry> m_entries;
+    std::unordered_map<std::wstring, std::list<Entry>::iterator> m_index;
+    std::unordered_map<Canonical::Key, std::list<Entry>::iterator, Canonical::KeyHash> m_canonical;
+    size_t m_hits = 0, m_misses = 0, m_evictions = 0;
+};
+
+// Compiled programs kept in a file between runs, so a warm start doesn't parse what it has seen.
+// The file is mapped on open and only its header is checked, each program is verified on first
+// use. A missing file or one of another format, ABI or compiled with other options starts the
+// cache empty. An expression found neither in memory nor in the file is looked up by its
+// canonical key among the programs compiled in this run before it is compiled.
+class PersistentCache {
+public:
+    explicit PersistentCache(const std::string &path, Optimizer::Options options = {}) : m_options(options) {
+        Open(path);
+    }
+
+    ProgramPtr Get(const std::wstring &expression) {
+        auto found = m_programs.find(expression);
+        if(found != m_programs.end()) return found->second;
+        ProgramPtr program = Load(expression);
+        if(program) ++m_loaded;
+        else {
+            const Tokens tokens = Detail::ParseExpression(expression);
+            ProgramPtr &known = m_canonical[Canonical::KeyOf(tokens)];
+            if(known) ++m_aliased;
+            else {
+                ++m_compiled;
+                known = Detail::CompileTokens(tokens, m_options);
+            }
+            program = known;
+        }
+        m_programs.emplace(expression, program);
+        return program;
+    }
+
+    // Write all programs, both used ones and ones from the file never asked for, and map the new file.
+    void Save(const std::string &path) {
+        Serialization::Entries entries;
+        for(const auto &item : m_programs) entries.emplace_back(item.first, Serialization::Serialize(*item.second));
+        for(size_t i = 0; m_file && i < m_file->Size(); ++i) {
+            std::wstring key = m_file->KeyAt(i);
+            if(m_programs.count(key)) continue;
+            const auto stored = m_file->ProgramAt(i);
+            try {
+                Serialization::Detail::Verify(stored.first, stored.second);
+                entries.emplace_back(std::move(key), std::vector<uint8_t>(stored.first, stored.first + stored.second));
+            }
+            catch(const std::runtime_error &) {
+            }
+        }
+        // The old file stays mapped until the new one is written, programs in it stay reachable
+        // when writing fails. Windows doesn't replace a mapped file, there it is mapped again.
+#ifdef _WIN32
+        m_file.reset();
+#endif
+        try {
+            Serialization::WriteProgramFile(path, std::move(entries), m_options);
+        }
+        catch(const std::runtime_error &) {
+            if(!m_file && !m_path.empty()) Open(m_path);
+            throw;
+        }
+        m_file.reset();
+        Open(path);
+    }
+
+    size_t Loaded() const {
+        return m_loaded;
+    }
+
+    size_t Compiled() const {
+        return m_compiled;
+    }
+
+    // Expressions given the program of an equivalent one instead of being compiled.
+    size_t Aliased() const {
+        return m_aliased;
+    }
+
+    // Stored programs that failed verification or were compiled with other options.
+    size_t Rejected() const {
+        return m_rejected;
+    }
+
+private:
+    void Open(const std::string &path) {
+        m_path.clear();
+        try {
+            m_file.reset(new Serialization::ProgramFile(path));
+        }
+        catch(const std::runtime_error &) {
+            return;
+        }
+        if(m_file->OptionsStamp() != Serialization::OptionsStamp(m_options)) {
+            m_rejected += m_file->Size();
+            m_file.reset();
+        }
+        else m_path = path;
+    }
+
+    ProgramPtr Load(const std::wstring &expression) {
+        if(!m_file) return nullptr;
+        try {
+            const auto stored = m_file->Find(expression);
+            if(!stored.first) return nullptr;
+            return std::make_shared<const Compiler::Program>(Serialization::Deserialize(stored.first, stored.second));
+        }
+        catch(const std::runtime_error &) {
+            ++m_rejected;
+            return nullptr;
+        }
+    }
+
+    Optimizer::Options m_options;
+    std::unique_ptr<Serialization::ProgramFile> m_file;
+    // Path of the mapped file.
+    std::string m_path;
+    std::unordered_map<std::wstring, ProgramPtr> m_programs;
+    std::unordered_map<Canonical::Key, ProgramPtr, Canonical::KeyHash> m_canonical;
+    size_t m_loaded = 0, m_compiled = 0, m_aliased = 0, m_rejected = 0;
+};
+
+namespace Detail {
+
+enum SharedState : uint32_t { Empty, Writing, Ready, Dead };
+
+// Texts and canonical keys share the table, a text may spell any canonical key.
+enum SharedKey : uint32_t { TextKey, CanonicalKey };
+
+struct SharedHeader {
+    std::atomic<uint32_t> m_state;
+    uint32_t m_version;
+    uint32_t m_abi;
+    uint32_t m_slots;
+    uint64_t m_arena;
+    std::atomic<uint64_t> m_used;
+    std::atomic<uint64_t> m_count;
+};
+
+// The tag holds the state in its low bits and the hash of the key in the others, so a writer
+// sees which key another one is still writing. Offsets are from the start of the arena, so
+// every process may map it at its own address.
+struct SharedSlot {
+    std::atomic<uint64_t> m_tag;
+    uint64_t m_options;
+    uint64_t m_keyOffset;
+    uint64_t m_programOffset;
+    uint64_t m_programSize;
+    uint32_t m_keyLength;
+    uint32_t m_keyKind;
+};
+
+const size_t SharedHeaderSize = 64;
+static_assert(sizeof(SharedHeader) <= SharedHeaderSize, "Header doesn't fit.");
+
+const uint64_t SharedStateMask = 3;
+
+inline uint64_t SharedTag(uint64_t hash, SharedState state) {
+    return (hash & ~SharedStateMask) | state;
+}
+} // namespace Detail
+
+// Programs in a named shared memory segment, so pre-forked workers compile every expression
+// only once for all of them. Keys are the expression with the stamp of the options, so caches
+// with other options share the segment without sharing programs. A writer claims a free slot
+// of the hash table by compare-and-swap, tagged with the hash of the key so others storing the
+// same key back off, then reserves space in the arena only if the program fits and publishes
+// the slot. No lock is ever held and a crashed writer only leaves its slot unused. A full table
+// or arena stops caching, programs already stored stay. Each process verifies a stored program
+// once, and deserializes it once for Get. A program is stored under the canonical key of its
+// expression, and every text it was asked for by gets a slot that points to the same program.
+// The slot says which kind of key it holds, so no text finds a canonical key spelled the same.
+class SharedProgramCache {
+public:
+    SharedProgramCache(const std::string &name, size_t slots = 4096, size_t arenaBytes = 64 << 20, Optimizer::Options options = {})
+        : m_memory(name, Detail::SharedHeaderSize + slots * sizeof(Detail::SharedSlot) + arenaBytes), m_options(options),
+          m_stamp(Serialization::OptionsStamp(options)), m_memos(new Memo[slots]) {
+        m_header = reinterpret_cast<Detail::SharedHeader *>(m_memory.Data());
+        m_slots = reinterpret_cast<Detail::SharedSlot *>(m_memory.Data() + Detail::SharedHeaderSize);
+        m_arena = m_memory.Data() + Detail::SharedHeaderSize + slots * sizeof(Detail::SharedSlot);
+        uint32_t state = Detail::Empty;
+        if(m_header->m_state.compare_exchange_strong(state, Detail::Writing)) Initialize(slots, arenaBytes);
+        // A process that died while writing the header leaves it unfinished, after a while another one takes over.
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while(m_header->m_state.load() != Detail::Ready) {
+            if(std::chrono::steady_clock::now() > deadline) Initialize(slots, arenaBytes);
+            else std::this_thread::yield();
+        }
+        if(m_header->m_version != Serialization::FormatVersion || m_header->m_abi != Serialization::AbiStamp() || m_header->m_slots != slots || m_header->m_arena != arenaBytes) {
+            throw std::runtime_error("Shared memory has another layout.");
+        }
+    }
+
+    SharedProgramCache(const SharedProgramCache &) = delete;
+    SharedProgramCache &operator=(const SharedProgramCache &) = delete;
+
+    ~SharedProgramCache() {
+        for(size_t i = 0; i < m_header->m_slots; ++i) delete m_memos[i].m_view.load();
+    }
+
+    ProgramPtr Get(const std::wstring &expression) {
+        ProgramPtr program;
+        const size_t slot = Store(expression, &program);
+        return program ? program : ProgramAt(slot);
+    }
+
+    // View of the program evaluated straight from shared memory, compiled and stored when missing.
+    // Throws when there is no room or another process is storing the expression right now.
+    Serialization::ProgramView View(const std::wstring &expression) {
+        const size_t slot = Store(expression, nullptr);
+        if(slot == NotFound) throw std::runtime_error("Program can't be stored in shared memory.");
+        return ViewAt(slot);
+    }
+
+    // Serialized program stored by any process under the key, nullptr when there is none.
+    std::pair<const uint8_t *, size_t> Find(const std::wstring &key) const {
+        const size_t slot = SlotOf(key, Detail::TextKey);
+        if(slot == NotFound) return{ nullptr, 0 };
+        return{ m_arena + m_slots[slot].m_programOffset, size_t(m_slots[slot].m_programSize) };
+    }
+
+    // Store the serialized program, false when there is no room or the key is being stored right now.
+    bool Insert(const std::wstring &key, const std::vector<uint8_t> &program) {
+        return Insert(key, Detail::TextKey, program);
+    }
+
+    // Programs stored by all processes.
+    size_t Size() const {
+        return static_cast<size_t>(m_header->m_count.load());
+    }
+
+    size_t Shared() const {
+        return m_shared.load();
+    }
+
+    size_t Compiled() const {
+        return m_compiled.load();
+    }
+
+private:
+    // What this process made of a stored program, built on first use.
+    struct Memo {
+        std::atomic<const Serialization::ProgramView *> m_view{ nullptr };
+        // Read and written with std::atomic_load and std::atomic_store.
+        ProgramPtr m_program;
+    };
+
+    static const size_t NotFound = SIZE_MAX;
+
+    void Initialize(size_t slots, size_t arenaBytes) {
+        m_header->m_version = Serialization::FormatVersion;
+        m_header->m_abi = Serialization::AbiStamp();
+        m_header->m_slots = static_cast<uint32_t>(slots);
+        m_header->m_arena = arenaBytes;
+        m_header->m_state.store(Detail::Ready);
+    }
+
+    bool Insert(const std::wstring &key, Detail::SharedKey kind, const std::vector<uint8_t> &program) {
+        const uint64_t hash = HashOf(key, kind);
+        for(size_t probe = 0; probe < m_header->m_slots; ++probe) {
+            Detail::SharedSlot &slot = m_slots[(hash + probe) % m_header->m_slots];
+            uint64_t tag = slot.m_tag.load(std::memory_order_acquire);
+            // A failed claim leaves the tag of the winner to look at.
+            if(tag == Detail::Empty && slot.m_tag.compare_exchange_strong(tag, Detail::SharedTag(hash, Detail::Writing))) return Fill(slot, hash, key, kind, &program, nullptr);
+            // A dead slot of the key means its program didn't fit, and the arena never grows.
+            if(tag == Detail::SharedTag(hash, Detail::Writing) || tag == Detail::SharedTag(hash, Detail::Dead)) return false;
+            if(tag == Detail::SharedTag(hash, Detail::Ready) && Matches(slot, key, kind)) return true;
+        }
+        return false;
+    }
+
+    // Slot of the expression, found under its text or its canonical key, or stored after compiling.
+    // The program compiled is kept in compiled when it is given, NotFound when it couldn't be stored.
+    size_t Store(const std::wstring &expression, ProgramPtr *compiled) {
+        size_t slot = SlotOf(expression, Detail::TextKey);
+        if(slot != NotFound) {
+            ++m_shared;
+            return slot;
+        }
+        const Tokens tokens = Detail::ParseExpression(expression);
+        const std::wstring key = Canonical::KeyOf(tokens).m_text;
+        slot = SlotOf(key, Detail::CanonicalKey);
+        if(slot != NotFound) ++m_shared;
+        else {
+            ++m_compiled;
+            ProgramPtr program = Detail::CompileTokens(tokens, m_options);
+            if(compiled) *compiled = program;
+            if(Insert(key, Detail::CanonicalKey, Serialization::Serialize(*program))) slot = SlotOf(key, Detail::CanonicalKey);
+            if(slot == NotFound) return NotFound;
+        }
+        Alias(expression, slot);
+        return slot;
+    }
+
+    // Store the text with the program of the slot, the program isn't copied.
+    void Alias(const std::wstring &key, size_t target) {
+        const uint64_t hash = HashOf(key, Detail::TextKey);
+        for(size_t probe = 0; probe < m_header->m_slots; ++probe) {
+            Detail::SharedSlot &slot = m_slots[(hash + probe) % m_header->m_slots];
+            uint64_t tag = slot.m_tag.load(std::memory_order_acquire);
+            if(tag == Detail::Empty && slot.m_tag.compare_exchange_strong(tag, Detail::SharedTag(hash, Detail::Writing))) {
+                Fill(slot, hash, key, Detail::TextKey, nullptr, &m_slots[target]);
+                return;
+            }
+            if(tag == Detail::SharedTag(hash, Detail::Writing) || tag == Detail::SharedTag(hash, Detail::Dead)) return;
+            if(tag == Detail::SharedTag(hash, Detail::Ready) && Matches(slot, key, Detail::TextKey)) return;
+        }
+    }
+
+    // Canonical keys probe from elsewhere than the text spelled the same.
+    uint64_t HashOf(const std::wstring &key, Detail::SharedKey kind) const {
+        return Canonical::Hash(key) ^ m_stamp ^ (kind == Detail::CanonicalKey ? 0x9e3779b97f4a7c15ull : 0);
+    }
+
+    size_t SlotOf(const std::wstring &key, Detail::SharedKey kind) const {
+        const uint64_t hash = HashOf(key, kind);
+        for(size_t probe = 0; probe < m_header->m_slots; ++probe) {
+            const size_t index = (hash + probe) % m_header->m_slots;
+            const uint64_t tag = m_slots[index].m_tag.load(std::memory_order_acquire);
+            if(tag == Detail::Empty) break;
+            if(tag == Detail::SharedTag(hash, Detail::Ready) && Matches(m_slots[index], key, kind)) return index;
+        }
+        return NotFound;
+    }
+
+    // Reserve arena space for the claimed slot only when the program fits, a slot without room is left dead.
+    // An alias takes the program of the target and space only for its key.
+    bool Fill(Detail::SharedSlot &slot, uint64_t hash, const std::wstring &key, Detail::SharedKey kind, const std::vector<uint8_t> *program, const Detail::SharedSlot *target) {
+        const size_t keyBytes = Serialization::Detail::AlignTo8(key.size() * sizeof(uint32_t));
+        const uint64_t size = keyBytes + (program ? program->size() : 0);
+        uint64_t offset = m_header->m_used.load();
+        do {
+            if(size > m_header->m_arena - offset) {
+                slot.m_tag.store(Detail::SharedTag(hash, Detail::Dead), std::memory_order_release);
+                return false;
+            }
+        } while(!m_header->m_used.compare_exchange_weak(offset, offset + size));
+        for(size_t ch = 0; ch < key.size(); ++ch) {
+            const uint32_t unit = static_cast<uint32_t>(key[ch]);
+            std::memcpy(m_arena + offset + ch * sizeof(uint32_t), &unit, sizeof(unit));
+        }
+        slot.m_options = m_stamp;
+        slot.m_keyLength = static_cast<uint32_t>(key.size());
+        slot.m_keyKind = kind;
+        slot.m_keyOffset = offset;
+        if(program) {
+            std::memcpy(m_arena + offset + keyBytes, program->data(), program->size());
+            slot.m_programOffset = offset + keyBytes;
+            slot.m_programSize = program->size();
+        }
+        else {
+            slot.m_programOffset = target->m_programOffset;
+            slot.m_programSize = target->m_programSize;
+        }
+        slot.m_tag.store(Detail::SharedTag(hash, Detail::Ready), std::memory_order_release);
+        if(program) ++m_header->m_count;
+        return true;
+    }
+
+    bool Matches(const Detail::SharedSlot &slot, const std::wstring &key, Detail::SharedKey kind) const {
+        if(slot.m_options != m_stamp || slot.m_keyKind != kind || slot.m_keyLength != key.size()) return false;
+        if(slot.m_keyOffset + key.size() * sizeof(uint32_t) > m_header->m_arena || slot.m_programOffset + slot.m_programSize > m_header->m_arena) return false;
+        for(size_t ch = 0; ch < key.size(); ++ch) {
+            if(Serialization::Detail::Load<uint32_t>(m_arena + slot.m_keyOffset + ch * sizeof(uint32_t)) != static_cast<uint32_t>(key[ch])) return false;
+        }
+        return true;
+    }
+
+    Serialization::ProgramView ViewAt(size_t slot) {
+        Memo &memo = m_memos[slot];
+        const Serialization::ProgramView *view = memo.m_view.load(std::memory_order_acquire);
+        if(view) return *view;
+        std::unique_ptr<const Serialization::ProgramView> verified(new Serialization::ProgramView(m_arena + m_slots[slot].m_programOffset, size_t(m_slots[slot].m_programSize)));
+        if(!memo.m_view.compare_exchange_strong(view, verified.get())) return *view;
+        return *verified.release();
+    }
+
+    ProgramPtr ProgramAt(size_t slot) {
+        Memo &memo = m_memos[slot];
+        ProgramPtr program = std::atomic_load(&memo.m_program);
+        if(program) return program;
+        program = std::make_shared<const Compiler::Program>(Serialization::Deserialize(m_arena + m_slots[slot].m_programOffset, size_t(m_slots[slot].m_programSize)));
+        std::atomic_store(&memo.m_program, program);
+        return program;
+    }
+
+    Serialization::SharedMemory m_memory;
+    Optimizer::Options m_options;
+    uint64_t m_stamp;
+    std::unique_ptr<Memo[]> m_memos;
+    Detail::SharedHeader *m_header;
+    Detail::SharedSlot *m_slots;
+    uint8_t *m_arena;
+    std::atomic<size_t> m_shared{ 0 }, m_compiled{ 0 };
+};
+} // namespace Cache
+
+// Interpret the expression with the program compiled once and kept in the cache.
+inline double InterpreteExperssion(const std::wstring &expression, Cache::ProgramCache &cache, const Bindings &bindings = {}) {
+    return cache.Get(expression)->Evaluate(bindings);
+}
+
+inline double InterpreteExperssion(const std::wstring &expression, Cache::ShardedProgramCache::Reader &reader, const Bindings &bindings = {}) {
+    return reader.Evaluate(expression, bindings);
+}
+
+// Interpret the expression, constant ones are computed once and kept in the cache.
+inline double InterpreteExperssion(const std::wstring &expression, Cache::ResultCache &cache, const Bindings &bindings = {}) {
+    return cache.Evaluate(expression, bindings);
+}
+} // namespace Interpreter
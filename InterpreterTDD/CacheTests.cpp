@@ -0,0 +1,500 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Cache.h"
+#include <thread>
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(ProgramCacheTests) {
+public:
+    static Cache::Limits LimitOfEntries(size_t entries) {
+        Cache::Limits limits;
+        limits.m_entries = entries;
+        return limits;
+    }
+
+    TEST_METHOD(Should_compile_once_and_hit_on_repeat) {
+        Cache::ProgramCache cache;
+        auto first = cache.Get(L"1+2*a");
+        auto second = cache.Get(L"1+2*a");
+        Assert::IsTrue(first == second);
+        Assert::AreEqual(size_t(1), cache.Hits());
+        Assert::AreEqual(size_t(1), cache.Misses());
+        Assert::AreEqual(size_t(1), cache.Size());
+    }
+
+    TEST_METHOD(Should_share_program_between_equivalent_expressions) {
+        Cache::ProgramCache cache;
+        auto first = cache.Get(L"a+b");
+        Assert::IsTrue(first == cache.Get(L"b+a"));
+        Assert::IsTrue(cache.Get(L"x") == cache.Get(L"x*1"));
+        Assert::AreEqual(size_t(2), cache.Hits());
+        Assert::AreEqual(size_t(2), cache.Misses());
+        Assert::AreEqual(size_t(2), cache.Size());
+        Assert::IsTrue(first == cache.Get(L"b+a"));
+        Assert::AreEqual(size_t(3), cache.Hits());
+    }
+
+    TEST_METHOD(Should_not_share_program_of_constant_with_variable_of_its_name) {
+        Cache::ProgramCache cache;
+        Assert::IsTrue(std::isinf(cache.Get(L"1/0")->Evaluate(Bindings{})));
+        Assert::AreEqual(5.0, cache.Get(L"inf")->Evaluate(Bindings{ { L"inf", 5 } }));
+        Assert::IsTrue(std::isnan(cache.Get(L"0/0")->Evaluate(Bindings{})));
+        Assert::AreEqual(5.0, cache.Get(L"nan")->Evaluate(Bindings{ { L"nan", 5 } }));
+        Assert::AreEqual(size_t(4), cache.Misses());
+    }
+
+    TEST_METHOD(Should_count_every_key_in_bytes) {
+        Cache::ProgramCache cache;
+        cache.Get(L"a+b");
+        const size_t bytes = cache.Bytes();
+        Assert::IsTrue(bytes > Cache::BytesOf(L"a+b", Compiler::Compile(Postfix(L"a+b"))));
+        cache.Get(L"b+a");
+        Assert::IsTrue(cache.Bytes() >= bytes + Cache::BytesOf(std::wstring(L"b+a")));
+    }
+
+    TEST_METHOD(Should_evict_least_recently_used) {
+        Cache::ProgramCache cache(LimitOfEntries(2));
+        cache.Get(L"1");
+        cache.Get(L"2");
+        cache.Get(L"1");
+        cache.Get(L"3");
+        Assert::AreEqual(size_t(1), cache.Evictions());
+        cache.Get(L"1");
+        Assert::AreEqual(size_t(2), cache.Hits());
+        cache.Get(L"2");
+        Assert::AreEqual(size_t(4), cache.Misses());
+    }
+
+    TEST_METHOD(Should_keep_bytes_within_limit) {
+        Cache::ProgramCache single;
+        single.Get(L"a+1");
+        Cache::Limits limits;
+        limits.m_bytes = 2 * single.Bytes();
+        Cache::ProgramCache cache(limits);
+        cache.Get(L"a+1");
+        cache.Get(L"b+1");
+        cache.Get(L"x+1");
+        Assert::AreEqual(size_t(2), cache.Size());
+        Assert::IsTrue(cache.Bytes() <= limits.m_bytes);
+    }
+
+    TEST_METHOD(Should_not_cache_when_limit_is_zero) {
+        Cache::ProgramCache cache(LimitOfEntries(0));
+        cache.Get(L"1");
+        cache.Get(L"1");
+        Assert::AreEqual(size_t(0), cache.Size());
+        Assert::AreEqual(size_t(2), cache.Misses());
+    }
+
+    TEST_METHOD(Should_interprete_expression_with_cache) {
+        Cache::ProgramCache cache;
+        const wstring expression = L"(x+1)*(x-1)/3";
+        Assert::AreEqual(InterpreteExperssion(expression, { { L"x", 4 } }), InterpreteExperssion(expression, cache, { { L"x", 4 } }));
+        Assert::AreEqual(InterpreteExperssion(expression, { { L"x", 5 } }), InterpreteExperssion(expression, cache, { { L"x", 5 } }));
+        Assert::AreEqual(size_t(1), cache.Hits());
+    }
+
+    TEST_METHOD(Should_not_cache_invalid_expression) {
+        Cache::ProgramCache cache;
+        Assert::ExpectException<std::logic_error>([&cache]() { cache.Get(L"(1+2"); });
+        Assert::AreEqual(size_t(0), cache.Size());
+    }
+};
+
+TEST_CLASS(ShardedProgramCacheTests) {
+public:
+    TEST_METHOD(Should_hit_on_repeat_in_sharded_cache) {
+        Cache::ShardedProgramCache cache;
+        Cache::ShardedProgramCache::Reader reader(cache);
+        const bool same = reader.Read(L"a*b", [&reader](const Compiler::Program &first) {
+            return reader.Read(L"a*b", [&first](const Compiler::Program &second) { return &first == &second; });
+        });
+        Assert::IsTrue(same);
+        Assert::AreEqual(size_t(1), cache.Hits());
+        Assert::AreEqual(size_t(1), cache.Misses());
+    }
+
+    TEST_METHOD(Should_share_program_of_equivalent_expression_in_sharded_cache) {
+        Cache::ShardedProgramCache cache;
+        Cache::ShardedProgramCache::Reader reader(cache);
+        const bool same = reader.Read(L"a+b", [&reader](const Compiler::Program &first) {
+            return reader.Read(L"b+a", [&first](const Compiler::Program &second) { return &first == &second; });
+        });
+        Assert::IsTrue(same);
+        Assert::AreEqual(size_t(1), cache.Hits());
+        Assert::AreEqual(size_t(1), cache.Misses());
+        Assert::AreEqual(size_t(2), cache.Size());
+        Assert::AreEqual(7.0, reader.Evaluate(L"b+a", { { L"a", 3 }, { L"b", 4 } }));
+        Assert::AreEqual(size_t(2), cache.Hits());
+    }
+
+    TEST_METHOD(Should_give_second_chance_to_referenced_entry) {
+        Cache::Limits limits;
+        limits.m_entries = 2;
+        Cache::ShardedProgramCache cache(limits, 1);
+        Cache::ShardedProgramCache::Reader reader(cache);
+        reader.Evaluate(L"1");
+        reader.Evaluate(L"2");
+        reader.Evaluate(L"1");
+        reader.Evaluate(L"3");
+        Assert::AreEqual(size_t(2), cache.Size());
+        Assert::AreEqual(size_t(1), cache.Evictions());
+        reader.Evaluate(L"1");
+        Assert::AreEqual(size_t(2), cache.Hits());
+    }
+
+    TEST_METHOD(Should_keep_entries_within_limit_of_whole_cache) {
+        Cache::Limits limits;
+        limits.m_entries = 3;
+        Cache::ShardedProgramCache cache(limits, 16);
+        Cache::ShardedProgramCache::Reader reader(cache);
+        for(int i = 0; i < 40; ++i) {
+            reader.Evaluate(to_wstring(i));
+            Assert::IsTrue(cache.Size() <= limits.m_entries);
+        }
+        Assert::AreEqual(size_t(3), cache.Size());
+        Assert::AreEqual(size_t(37), cache.Evictions());
+    }
+
+    TEST_METHOD(Should_keep_evicted_program_alive_for_reader) {
+        Cache::Limits limits;
+        limits.m_entries = 1;
+        Cache::ShardedProgramCache cache(limits, 1);
+        Cache::ShardedProgramCache::Reader reader(cache);
+        const double value = reader.Read(L"x+1", [&](const Compiler::Program &program) {
+            reader.Evaluate(L"x+2", { { L"x", 2 } });
+            Assert::AreEqual(size_t(1), cache.Evictions());
+            return program.Evaluate({ { L"x", 2 } });
+        });
+        Assert::AreEqual(3.0, value);
+    }
+
+    TEST_METHOD(Should_serve_same_programs_to_concurrent_readers) {
+        Cache::ShardedProgramCache cache;
+        const wstring expressions[] = { L"a+1", L"a*2", L"a/4", L"a-8" };
+        std::vector<std::thread> threads;
+        std::atomic<int> wrong{ 0 };
+        for(int t = 0; t < 8; ++t) {
+            threads.emplace_back([&]() {
+                Cache::ShardedProgramCache::Reader reader(cache);
+                for(int i = 0; i < 1000; ++i) {
+                    const wstring &expression = expressions[i % 4];
+                    if(InterpreteExperssion(expression, reader, { { L"a", 8 } }) != InterpreteExperssion(expression, { { L"a", 8 } })) ++wrong;
+                }
+            });
+        }
+        for(auto &thread : threads) thread.join();
+        Assert::AreEqual(0, wrong.load());
+        Assert::AreEqual(size_t(4), cache.Size());
+        Assert::AreEqual(size_t(8000), cache.Hits() + cache.Misses());
+    }
+
+    TEST_METHOD(Should_stay_within_limits_while_readers_evict) {
+        Cache::Limits limits;
+        limits.m_entries = 8;
+        Cache::ShardedProgramCache cache(limits, 4);
+        std::vector<std::thread> threads;
+        std::atomic<int> wrong{ 0 };
+        for(int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]() {
+                Cache::ShardedProgramCache::Reader reader(cache);
+                for(int i = 0; i < 500; ++i) {
+                    const int k = (i * 7 + t) % 32;
+                    if(reader.Evaluate(L"x+" + to_wstring(k), { { L"x", 1 } }) != 1 + k) ++wrong;
+                }
+            });
+        }
+        for(auto &thread : threads) thread.join();
+        Assert::AreEqual(0, wrong.load());
+        Assert::IsTrue(cache.Size() <= limits.m_entries);
+        Assert::AreEqual(size_t(2000), cache.Hits() + cache.Misses());
+    }
+};
+
+TEST_CLASS(ResultCacheTests) {
+public:
+    TEST_METHOD(Should_return_cached_value_of_constant_expression) {
+        Cache::ResultCache cache;
+        Assert::AreEqual(InterpreteExperssion(L"(1+2)*3/7"), InterpreteExperssion(L"(1+2)*3/7", cache));
+        Assert::AreEqual(InterpreteExperssion(L"(1+2)*3/7"), InterpreteExperssion(L"( 1 + 2.0 ) * 3 / 7", cache));
+        Assert::AreEqual(size_t(1), cache.Hits());
+        Assert::AreEqual(size_t(1), cache.Size());
+    }
+
+    TEST_METHOD(Should_share_value_of_equivalent_expressions) {
+        Cache::ResultCache cache;
+        Assert::AreEqual(3.0, cache.Evaluate(L"(1+2)"));
+        Assert::AreEqual(3.0, cache.Evaluate(L"1+2"));
+        Assert::AreEqual(3.0, cache.Evaluate(L"2+1"));
+        Assert::AreEqual(size_t(1), cache.Misses());
+        Assert::AreEqual(size_t(2), cache.Hits());
+        Assert::AreEqual(size_t(1), cache.Size());
+        Assert::AreEqual(3.0, cache.Evaluate(L"1+2"));
+        Assert::AreEqual(size_t(3), cache.Hits());
+    }
+
+    TEST_METHOD(Should_evict_value_with_all_its_texts) {
+        Cache::ResultCache cache(2);
+        cache.Evaluate(L"1+2");
+        cache.Evaluate(L"2+1");
+        cache.Evaluate(L"5");
+        Assert::AreEqual(size_t(1), cache.Size());
+        Assert::AreEqual(size_t(1), cache.Evictions());
+        cache.Evaluate(L"1+2");
+        Assert::AreEqual(size_t(3), cache.Misses());
+    }
+
+    TEST_METHOD(Should_not_cache_expression_with_variables) {
+        Cache::ResultCache cache;
+        Assert::AreEqual(3.0, cache.Evaluate(L"a+1", { { L"a", 2 } }));
+        Assert::AreEqual(4.0, cache.Evaluate(L"a+1", { { L"a", 3 } }));
+        Assert::AreEqual(size_t(0), cache.Size());
+        Assert::AreEqual(size_t(0), cache.Misses());
+    }
+
+    TEST_METHOD(Should_evict_least_recently_used_value) {
+        Cache::ResultCache cache(2);
+        cache.Evaluate(L"1");
+        cache.Evaluate(L"2");
+        cache.Evaluate(L"1");
+        cache.Evaluate(L"3");
+        cache.Evaluate(L"1");
+        Assert::AreEqual(size_t(2), cache.Size());
+        Assert::AreEqual(size_t(1), cache.Evictions());
+        Assert::AreEqual(size_t(2), cache.Hits());
+    }
+
+    TEST_METHOD(Should_store_nothing_when_disabled) {
+        Cache::ResultCache cache;
+        cache.Evaluate(L"1+1");
+        cache.SetEnabled(false);
+        Assert::AreEqual(2.0, cache.Evaluate(L"1+1"));
+        Assert::AreEqual(size_t(0), cache.Size());
+        Assert::AreEqual(size_t(0), cache.Hits());
+    }
+};
+
+TEST_CLASS(PersistentCacheTests) {
+public:
+    TEST_METHOD(Should_load_saved_programs_without_compiling) {
+        const std::string path = "PersistentCacheTests.programs";
+        {
+            Cache::PersistentCache cache(path);
+            cache.Get(L"x*2+1");
+            cache.Get(L"x/4");
+            Assert::AreEqual(size_t(2), cache.Compiled());
+            cache.Save(path);
+        }
+        {
+            Cache::PersistentCache cache(path);
+            Assert::AreEqual(7.0, cache.Get(L"x*2+1")->Evaluate({ { L"x", 3 } }));
+            Assert::AreEqual(size_t(1), cache.Loaded());
+            Assert::AreEqual(size_t(0), cache.Compiled());
+            cache.Save(path);
+        }
+        Cache::PersistentCache cache(path);
+        cache.Get(L"x/4");
+        Assert::AreEqual(size_t(1), cache.Loaded());
+        std::remove(path.c_str());
+    }
+
+    TEST_METHOD(Should_compile_when_stored_program_is_corrupted) {
+        const std::string path = "PersistentCacheTests.corrupted";
+        auto bytes = Serialization::Serialize(Compiler::Compile(Postfix(L"x+1")));
+        bytes.back() ^= 1;
+        Serialization::WriteProgramFile(path, { { L"x+1", bytes } });
+        {
+            Cache::PersistentCache cache(path);
+            Assert::AreEqual(3.0, cache.Get(L"x+1")->Evaluate({ { L"x", 2 } }));
+            Assert::AreEqual(size_t(1), cache.Rejected());
+            Assert::AreEqual(size_t(1), cache.Compiled());
+        }
+        std::remove(path.c_str());
+    }
+
+    TEST_METHOD(Should_reject_programs_compiled_with_other_options) {
+        const std::string path = "PersistentCacheTests.options";
+        {
+            Cache::PersistentCache cache(path);
+            cache.Get(L"x*2+1");
+            cache.Save(path);
+        }
+        Optimizer::Options options;
+        options.m_mode = Optimizer::Mode::FastMath;
+        {
+            Cache::PersistentCache cache(path, options);
+            Assert::AreEqual(7.0, cache.Get(L"x*2+1")->Evaluate({ { L"x", 3 } }));
+            Assert::AreEqual(size_t(1), cache.Rejected());
+            Assert::AreEqual(size_t(0), cache.Loaded());
+            Assert::AreEqual(size_t(1), cache.Compiled());
+            cache.Save(path);
+        }
+        Cache::PersistentCache cache(path, options);
+        cache.Get(L"x*2+1");
+        Assert::AreEqual(size_t(1), cache.Loaded());
+        std::remove(path.c_str());
+    }
+
+    TEST_METHOD(Should_keep_stored_programs_when_save_fails) {
+        const std::string path = "PersistentCacheTests.kept";
+        {
+            Cache::PersistentCache cache(path);
+            cache.Get(L"x*2+1");
+            cache.Save(path);
+        }
+        {
+            Cache::PersistentCache cache(path);
+            Assert::ExpectException<std::runtime_error>([&cache]() { cache.Save("PersistentCacheTests.missing/programs"); });
+            Assert::AreEqual(7.0, cache.Get(L"x*2+1")->Evaluate({ { L"x", 3 } }));
+            Assert::AreEqual(size_t(1), cache.Loaded());
+            Assert::AreEqual(size_t(0), cache.Compiled());
+        }
+        std::remove(path.c_str());
+    }
+
+    TEST_METHOD(Should_compile_equivalent_expressions_once) {
+        Cache::PersistentCache cache("PersistentCacheTests.missing");
+        Assert::IsTrue(cache.Get(L"x*1+y") == cache.Get(L"y+x"));
+        Assert::AreEqual(size_t(1), cache.Compiled());
+        Assert::AreEqual(size_t(1), cache.Aliased());
+    }
+
+    TEST_METHOD(Should_start_empty_without_file) {
+        Cache::PersistentCache cache("PersistentCacheTests.missing");
+        Assert::AreEqual(1.0, cache.Get(L"1")->Evaluate());
+        Assert::AreEqual(size_t(1), cache.Compiled());
+    }
+};
+
+TEST_CLASS(SharedProgramCacheTests) {
+public:
+    TEST_METHOD(Should_share_programs_between_mappings) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache first(name, 64, 1 << 16);
+            Cache::SharedProgramCache second(name, 64, 1 << 16);
+            first.Get(L"x*2+1");
+            Assert::AreEqual(7.0, second.Get(L"x*2+1")->Evaluate({ { L"x", 3 } }));
+            Assert::AreEqual(size_t(1), first.Compiled());
+            Assert::AreEqual(size_t(1), second.Shared());
+            Assert::AreEqual(size_t(0), second.Compiled());
+            Assert::AreEqual(size_t(1), second.Size());
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_view_shared_program_in_place) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.View";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache first(name, 64, 1 << 16);
+            Cache::SharedProgramCache second(name, 64, 1 << 16);
+            first.Get(L"x*2+1");
+            Assert::AreEqual(9.0, second.View(L"x*2+1").Evaluate({ { L"x", 4 } }));
+            Assert::AreEqual(size_t(1), second.Shared());
+            Assert::AreEqual(size_t(0), second.Compiled());
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_stop_caching_when_arena_is_full) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.Full";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache cache(name, 64, 256);
+            for(int i = 0; i < 10; ++i) cache.Get(L"x+" + to_wstring(i));
+            Assert::IsTrue(cache.Size() < 10);
+            Assert::AreEqual(5.0, cache.Get(L"x+3")->Evaluate({ { L"x", 2 } }));
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_deserialize_shared_program_once) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.Once";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache first(name, 64, 1 << 16);
+            Cache::SharedProgramCache second(name, 64, 1 << 16);
+            first.Get(L"x*2+1");
+            Assert::IsTrue(second.Get(L"x*2+1") == second.Get(L"x*2+1"));
+            Assert::AreEqual(size_t(2), second.Shared());
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_keep_programs_of_other_options_apart) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.Options";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Optimizer::Options options;
+            options.m_mode = Optimizer::Mode::FastMath;
+            Cache::SharedProgramCache strict(name, 64, 1 << 16);
+            Cache::SharedProgramCache fast(name, 64, 1 << 16, options);
+            strict.Get(L"x*2+1");
+            fast.Get(L"x*2+1");
+            Assert::AreEqual(size_t(1), fast.Compiled());
+            Assert::AreEqual(size_t(2), fast.Size());
+            strict.Get(L"x*2+1");
+            Assert::AreEqual(size_t(1), strict.Shared());
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_not_take_arena_space_for_program_that_does_not_fit) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.Room";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache cache(name, 64, 256);
+            Assert::IsFalse(cache.Insert(L"big", std::vector<uint8_t>(1024)));
+            Assert::IsFalse(cache.Insert(L"big", std::vector<uint8_t>(8)));
+            Assert::IsTrue(cache.Insert(L"x+1", Serialization::Serialize(Compiler::Compile(Postfix(L"x+1")))));
+            Assert::AreEqual(3.0, cache.Get(L"x+1")->Evaluate({ { L"x", 2 } }));
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_store_equivalent_expressions_once) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.Canonical";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache first(name, 64, 1 << 16);
+            Cache::SharedProgramCache second(name, 64, 1 << 16);
+            first.Get(L"a+b");
+            Assert::AreEqual(7.0, second.View(L"b+a").Evaluate({ { L"a", 3 }, { L"b", 4 } }));
+            Assert::AreEqual(size_t(0), second.Compiled());
+            Assert::AreEqual(size_t(1), second.Size());
+            Assert::IsTrue(second.Find(L"b+a") == second.Find(L"a+b"));
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_keep_texts_apart_from_canonical_keys) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.Kinds";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache cache(name, 64, 1 << 16);
+            Assert::IsTrue(std::isinf(cache.Get(L"1/0")->Evaluate(Bindings{})));
+            // The lexer skips the marks, the text is the variable inf.
+            const std::wstring text = L"#" + Canonical::KeyOf(L"1/0").m_text;
+            Assert::AreEqual(5.0, cache.Get(text)->Evaluate(Bindings{ { L"inf", 5 } }));
+            Assert::AreEqual(5.0, cache.View(text).Evaluate({ { L"inf", 5 } }));
+            Assert::AreEqual(size_t(2), cache.Compiled());
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+
+    TEST_METHOD(Should_throw_when_layout_differs) {
+        const std::string name = "InterpreterTDD.SharedProgramCacheTests.Layout";
+        Serialization::SharedMemory::Remove(name);
+        {
+            Cache::SharedProgramCache cache(name, 64, 1 << 16);
+            Assert::ExpectException<std::runtime_error>([&name]() { Cache::SharedProgramCache other(name, 32, 1 << 16); });
+        }
+        Serialization::SharedMemory::Remove(name);
+    }
+};
+
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include "Optimizer.h"
+#include <cstdint>
+#include <cwchar>
+
+namespace Interpreter {
+namespace Canonical {
+
+// Key of the expression that is the same for all spellings of it with the same value,
+// the text is compared on a hash collision.
+struct Key {
+    std::wstring m_text;
+    uint64_t m_hash;
+};
+
+inline bool operator==(const Key &left, const Key &right) {
+    return left.m_hash == right.m_hash && left.m_text == right.m_text;
+}
+
+struct KeyHash {
+    size_t operator()(const Key &key) const {
+        return static_cast<size_t>(key.m_hash);
+    }
+};
+
+// 64-bit FNV-1a of the characters, stable across runs and platforms.
+inline uint64_t Hash(const std::wstring &text) {
+    uint64_t hash = 14695981039346656037ull;
+    for(wchar_t ch : text) {
+        uint32_t unit = static_cast<uint32_t>(ch);
+        for(int byte = 0; byte < 4; ++byte, unit >>= 8) {
+            hash ^= unit & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+namespace Detail {
+
+using Ast::NodePtr;
+
+// Numbers, then variables, then operators.
+inline int RankOf(const Token &token) {
+    if(PayloadOf<double>(token)) return 0;
+    if(PayloadOf<Variable>(token)) return 1;
+    return 2;
+}
+
+inline int Compare(const Token &left, const Token &right) {
+    const int leftRank = RankOf(left), rightRank = RankOf(right);
+    if(leftRank != rightRank) return leftRank < rightRank ? -1 : 1;
+    if(const double *num = PayloadOf<double>(left)) {
+        const double other = *PayloadOf<double>(right);
+        if(std::signbit(*num) != std::signbit(other)) return std::signbit(*num) ? -1 : 1;
+        if(std::isnan(*num) || std::isnan(other)) return std::isnan(*num) == std::isnan(other) ? 0 : std::isnan(*num) ? 1 : -1;
+        return *num == other ? 0 : *num < other ? -1 : 1;
+    }
+    if(const Variable *variable = PayloadOf<Variable>(left)) {
+        return variable->m_name.compare(PayloadOf<Variable>(right)->m_name);
+    }
+    const int leftOp = static_cast<int>(*PayloadOf<Operator>(left)), rightOp = static_cast<int>(*PayloadOf<Operator>(right));
+    return leftOp == rightOp ? 0 : leftOp < rightOp ? -1 : 1;
+}
+
+// Total order of trees: by token, then by number of arguments, then by arguments from left to right.
+inline int Compare(const NodePtr &left, const NodePtr &right) {
+    std::vector<std::pair<const Ast::Node *, const Ast::Node *>> pending{ { left.get(), right.get() } };
+    while(!pending.empty()) {
+        auto pair = pending.back();
+        pending.pop_back();
+        if(pair.first == pair.second) continue;
+        if(int order = Compare(pair.first->m_token, pair.second->m_token)) return order;
+        if(pair.first->m_args.size() != pair.second->m_args.size()) return pair.first->m_args.size() < pair.second->m_args.size() ? -1 : 1;
+        for(size_t i = pair.first->m_args.size(); i-- > 0;) {
+            pending.emplace_back(pair.first->m_args[i].get(), pair.second->m_args[i].get());
+        }
+    }
+    return 0;
+}
+
+// Arguments of commutative operations are put in order, swapping them is exact in IEEE arithmetic.
+inline NodePtr OrderArguments(const NodePtr &node, Ast::Nodes args) {
+    const bool commutative = node->m_token == Operator::Plus || node->m_token == Operator::Mul || node->m_token == Operator::FusedMulAdd;
+    if(commutative && Compare(args[1], args[0]) < 0) std::swap(args[0], args[1]);
+    return Ast::Rebuild(node, std::move(args));
+}
+
+class TextWriter : public TokenVisitor {
+public:
+    explicit TextWriter(bool maskNumbers = false) : m_maskNumbers(maskNumbers) {}
+
+    std::wstring Result() const {
+        return m_text;
+    }
+
+private:
+    // Enough digits to read back the same double, every NaN is written the same. The mark keeps
+    // infinity and NaN apart from variables named inf and nan, no identifier starts with it.
+    void Visit(double num) override {
+        wchar_t buffer[32];
+        std::swprintf(buffer, sizeof(buffer) / sizeof(buffer[0]), L"#%.17g", num);
+        Append(m_maskNumbers ? L"?" : std::isnan(num) ? L"#nan" : buffer);
+    }
+
+    void Visit(Operator op) override {
+        Append(ToString(op));
+    }
+
+    void Visit(const Variable &variable) override {
+        Append(variable.m_name);
+    }
+
+    void Append(const std::wstring &text) {
+        if(!m_text.empty()) m_text += L' ';
+        m_text += text;
+    }
+
+    bool m_maskNumbers;
+    std::wstring m_text;
+};
+
+inline Key KeyOfText(std::wstring text) {
+    const uint64_t hash = Hash(text);
+    return{ std::move(text), hash };
+}
+} // namespace Detail
+
+// Strictly simplify the tree and order arguments of commutative operations,
+// the result is evaluated to exactly the same value.
+inline Ast::NodePtr Normalize(const Ast::NodePtr &root) {
+    return Ast::Transform(Optimizer::Simplify(root), Detail::OrderArguments);
+}
+
+// Normalize the sequence of tokens in postfix notation.
+inline Tokens Normalize(const Tokens &tokens) {
+    return Ast::ToPostfix(Normalize(Ast::Build(tokens)));
+}
+
+// Text of the sequence of tokens with numbers written exactly.
+inline std::wstring ToText(const Tokens &tokens) {
+    Detail::TextWriter writer;
+    writer.VisitAll(tokens.cbegin(), tokens.cend());
+    return writer.Result();
+}
+
+// Key of the sequence of tokens in postfix notation.
+inline Key KeyOf(const Tokens &tokens) {
+    return Detail::KeyOfText(ToText(Normalize(tokens)));
+}
+
+// Key of the sequence of tokens as given with every number written the same,
+// expressions that differ only in literals have the same shape.
+inline Key ShapeOf(const Tokens &tokens) {
+    Detail::TextWriter writer(true);
+    writer.VisitAll(tokens.cbegin(), tokens.cend());
+    return Detail::KeyOfText(writer.Result());
+}
+
+// Key of the mathematical expression in infix notation.
+inline Key KeyOf(const std::wstring &expression) {
+    return KeyOf(Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression))));
+}
+} // namespace Canonical
+} // namespace Interpreter
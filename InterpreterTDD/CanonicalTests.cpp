@@ -0,0 +1,52 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Canonical.h"
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(CanonicalTests) {
+public:
+    TEST_METHOD(Should_order_arguments_of_commutative_operations) {
+        Tokens tokens = Canonical::Normalize(Postfix(L"b*x + 2*a"));
+        AssertRange::AreEqual({ _2, a, mul, b, x, mul, plus }, tokens);
+    }
+
+    TEST_METHOD(Should_not_reorder_non_commutative_operations) {
+        Tokens tokens = Canonical::Normalize(Postfix(L"b - a / x"));
+        AssertRange::AreEqual({ b, a, x, div, minus }, tokens);
+    }
+
+    TEST_METHOD(Should_give_same_key_to_equivalent_spellings) {
+        auto key = Canonical::KeyOf(L"(b + 2*a) * 1");
+        Assert::IsTrue(key == Canonical::KeyOf(L"+(a*2) + --b"));
+        Assert::AreEqual(wstring(L"b #2 a * +"), key.m_text);
+        Assert::AreEqual(Canonical::Hash(key.m_text), key.m_hash);
+    }
+
+    TEST_METHOD(Should_keep_keys_apart_when_values_may_differ) {
+        // Reassociation and x+0 change the result in IEEE arithmetic.
+        Assert::IsFalse(Canonical::KeyOf(L"(a + b) + x") == Canonical::KeyOf(L"a + (b + x)"));
+        Assert::IsFalse(Canonical::KeyOf(L"a + 0") == Canonical::KeyOf(L"a"));
+        Assert::IsFalse(Canonical::KeyOf(L"1/0") == Canonical::KeyOf(L"1/-0"));
+    }
+
+    TEST_METHOD(Should_write_numbers_exactly) {
+        auto key = Canonical::KeyOf(L"0.1 + a");
+        Assert::AreEqual(wstring(L"#0.10000000000000001 a +"), key.m_text);
+    }
+
+    TEST_METHOD(Should_keep_infinity_and_nan_apart_from_variables) {
+        Assert::IsFalse(Canonical::KeyOf(L"1/0") == Canonical::KeyOf(L"inf"));
+        Assert::IsFalse(Canonical::KeyOf(L"0/0") == Canonical::KeyOf(L"nan"));
+        Assert::AreEqual(wstring(L"#inf"), Canonical::KeyOf(L"1/0").m_text);
+    }
+
+    TEST_METHOD(Should_evaluate_normalized_to_same_value) {
+        const Bindings bindings{ { L"a", 0.1 }, { L"b", 0.2 }, { L"x", 0.3 } };
+        Tokens tokens = Postfix(L"x*(b + a) - -a/3*b + (x + 0.7)*a");
+        Assert::AreEqual(Evaluator::Evaluate(tokens, bindings), Evaluator::Evaluate(Canonical::Normalize(tokens), bindings));
+    }
+};
+
+}
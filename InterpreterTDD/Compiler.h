@@ -0,0 +1,434 @@
+#pragma once
+#include "Canonical.h"
+#include <cstdint>
+#include <cstring>
+
+namespace Interpreter {
+namespace Serialization {
+namespace Detail {
+class ProgramReader;
+} // namespace Detail
+} // namespace Serialization
+
+namespace Compiler {
+
+enum class OpCode : uint8_t {
+    Constant, Variable, Parameter, Store, Load, Output, Add, Subtract, Multiply, Divide, Negate, FusedMultiplyAdd,
+};
+
+struct Instruction {
+    OpCode m_code;
+    uint32_t m_operand;
+};
+
+inline bool operator==(const Instruction &left, const Instruction &right) {
+    return left.m_code == right.m_code && left.m_operand == right.m_operand;
+}
+
+namespace Detail {
+class ProgramBuilder;
+} // namespace Detail
+
+// Working memory of evaluation, one per thread and reused for every program it evaluates.
+// Values start at a cache line and fill whole lines, so scratches of different threads never
+// share a line.
+class Scratch {
+public:
+    double *Reserve(size_t count) {
+        const size_t lineValues = 64 / sizeof(double);
+        const size_t needed = (count + lineValues - 1) / lineValues * lineValues + lineValues;
+        if(m_values.size() < needed) m_values.resize(needed);
+        const size_t misalignment = reinterpret_cast<uintptr_t>(m_values.data()) % 64;
+        return m_values.data() + (misalignment ? (64 - misalignment) / sizeof(double) : 0);
+    }
+
+    // Buffer for a variable name read from a serialized program, it keeps its capacity.
+    std::wstring &Name() {
+        return m_name;
+    }
+
+private:
+    std::vector<double> m_values;
+    std::wstring m_name;
+};
+
+// Bytecode for a stack machine. Each common subexpression is computed once, stored to
+// a temporary slot and loaded from there on every other use. A program never changes after
+// compilation, so threads may evaluate one through a plain reference, each with its own
+// Scratch. The object starts on a cache line of its own; its code and constants live in
+// separate heap blocks with the default alignment, which may share a line with other data.
+class alignas(64) Program {
+public:
+    // Evaluate with variables looked up by name.
+    double Evaluate(const Bindings &bindings = {}) const {
+        Scratch scratch;
+        return Evaluate(bindings, scratch);
+    }
+
+    // Evaluate with variables looked up by name and values of hoisted literals.
+    double Evaluate(const Bindings &bindings, const std::vector<double> &parameters) const {
+        Scratch scratch;
+        return Evaluate(bindings, scratch, parameters);
+    }
+
+    // Evaluate with variables looked up by name, without allocating.
+    double Evaluate(const Bindings &bindings, Scratch &scratch, const std::vector<double> &parameters = {}) const {
+        if(m_outputs > 1) throw std::logic_error("Program has several outputs.");
+        double *const values = scratch.Reserve(m_variables.size() + m_stackDepth + m_slots);
+        ValuesOf(bindings, values);
+        double result = 0.0;
+        Run(values, parameters, &result, values + m_variables.size());
+        return result;
+    }
+
+    // Evaluate with values of variables in order of Variables().
+    double Evaluate(const std::vector<double> &variables, const std::vector<double> &parameters = {}) const {
+        Scratch scratch;
+        return Evaluate(variables, scratch, parameters);
+    }
+
+    // Evaluate without allocating, in the working memory of the calling thread.
+    double Evaluate(const std::vector<double> &variables, Scratch &scratch, const std::vector<double> &parameters = {}) const {
+        if(m_outputs > 1) throw std::logic_error("Program has several outputs.");
+        if(variables.size() != m_variables.size()) throw std::logic_error("Wrong number of variables.");
+        double result = 0.0;
+        Run(variables.data(), parameters, &result, scratch.Reserve(m_stackDepth + m_slots));
+        return result;
+    }
+
+    // Evaluate all formulas the program was compiled from in one pass.
+    std::vector<double> EvaluateAll(const Bindings &bindings = {}, const std::vector<double> &parameters = {}) const {
+        std::vector<double> results;
+        Scratch scratch;
+        EvaluateAll(bindings, scratch, results, parameters);
+        return results;
+    }
+
+    // Evaluate all formulas into the results, which allocates only when they have to grow.
+    void EvaluateAll(const Bindings &bindings, Scratch &scratch, std::vector<double> &results, const std::vector<double> &parameters = {}) const {
+        double *const values = scratch.Reserve(m_variables.size() + m_stackDepth + m_slots);
+        ValuesOf(bindings, values);
+        results.assign(Outputs(), 0.0);
+        Run(values, parameters, results.data(), values + m_variables.size());
+    }
+
+    std::vector<double> EvaluateAll(const std::vector<double> &variables, const std::vector<double> &parameters = {}) const {
+        if(variables.size() != m_variables.size()) throw std::logic_error("Wrong number of variables.");
+        std::vector<double> results(Outputs());
+        Scratch scratch;
+        Run(variables.data(), parameters, results.data(), scratch.Reserve(m_stackDepth + m_slots));
+        return results;
+    }
+
+    const std::vector<Instruction> &Code() const {
+        return m_code;
+    }
+
+    const std::vector<double> &Constants() const {
+        return m_constants;
+    }
+
+    const std::vector<std::wstring> &Variables() const {
+        return m_variables;
+    }
+
+    // Number of literals hoisted out of the code, their values are given on evaluation.
+    size_t Parameters() const {
+        return m_parameters;
+    }
+
+    // Number of results, a program compiled from one expression leaves its only result on the stack.
+    size_t Outputs() const {
+        return std::max<size_t>(m_outputs, 1);
+    }
+
+    size_t Slots() const {
+        return m_slots;
+    }
+
+    size_t StackDepth() const {
+        return m_stackDepth;
+    }
+
+private:
+    friend class Detail::ProgramBuilder;
+    friend class Serialization::Detail::ProgramReader;
+
+    // Memory holds the stack followed by the slots.
+    void Run(const double *variables, const std::vector<double> &parameters, double *outputs, double *memory) const {
+        if(parameters.size() != m_parameters) throw std::logic_error("Wrong number of parameters.");
+        double *const stack = memory;
+        double *const slots = stack + m_stackDepth;
+        double *top = stack;
+        for(const auto &instruction : m_code) {
+            switch(instruction.m_code) {
+                case OpCode::Constant: *top++ = m_constants[instruction.m_operand]; break;
+                case OpCode::Variable: *top++ = variables[instruction.m_operand]; break;
+                case OpCode::Parameter: *top++ = parameters[instruction.m_operand]; break;
+                case OpCode::Store: slots[instruction.m_operand] = top[-1]; break;
+                case OpCode::Load: *top++ = slots[instruction.m_operand]; break;
+                case OpCode::Output: outputs[instruction.m_operand] = *--top; break;
+                case OpCode::Add: --top; top[-1] = top[-1] + top[0]; break;
+                case OpCode::Subtract: --top; top[-1] = top[-1] - top[0]; break;
+                case OpCode::Multiply: --top; top[-1] = top[-1] * top[0]; break;
+                case OpCode::Divide: --top; top[-1] = top[-1] / top[0]; break;
+                case OpCode::Negate: top[-1] = -top[-1]; break;
+                case OpCode::FusedMultiplyAdd: top -= 2; top[-1] = std::fma(top[-1], top[0], top[1]); break;
+            }
+        }
+        if(top != stack) outputs[0] = top[-1];
+    }
+
+    void ValuesOf(const Bindings &bindings, double *values) const {
+        for(const auto &name : m_variables) {
+            auto value = bindings.find(name);
+            if(value == bindings.end()) throw std::logic_error("Variable is not bound.");
+            *values++ = value->second;
+        }
+    }
+
+    std::vector<Instruction> m_code;
+    std::vector<double> m_constants;
+    std::vector<std::wstring> m_variables;
+    size_t m_parameters = 0;
+    size_t m_outputs = 0;
+    size_t m_slots = 0;
+    size_t m_stackDepth = 0;
+};
+
+namespace Detail {
+
+inline OpCode OpCodeOf(Operator op) {
+    switch(op) {
+        case Operator::Plus: return OpCode::Add;
+        case Operator::Minus: return OpCode::Subtract;
+        case Operator::Mul: return OpCode::Multiply;
+        case Operator::Div: return OpCode::Divide;
+        case Operator::UMinus: return OpCode::Negate;
+        case Operator::FusedMulAdd: return OpCode::FusedMultiplyAdd;
+        default: throw std::logic_error("Operator can't be compiled.");
+    }
+}
+
+inline Operator OperatorOf(OpCode code) {
+    switch(code) {
+        case OpCode::Add: return Operator::Plus;
+        case OpCode::Subtract: return Operator::Minus;
+        case OpCode::Multiply: return Operator::Mul;
+        case OpCode::Divide: return Operator::Div;
+        case OpCode::Negate: return Operator::UMinus;
+        case OpCode::FusedMultiplyAdd: return Operator::FusedMulAdd;
+        default: throw std::logic_error("Instruction is not an operation.");
+    }
+}
+
+class ProgramBuilder : private TokenVisitor {
+public:
+    ProgramBuilder(const Ast::NodePtr &root, bool hoistLiterals) : m_hoistLiterals(hoistLiterals) {
+        CountUses(root);
+        if(root) Emit(root);
+    }
+
+    // Each root is computed and written to its output, subtrees common to several roots only once.
+    explicit ProgramBuilder(const Ast::Nodes &roots) : m_hoistLiterals(false) {
+        for(const auto &root : roots) CountUses(root);
+        for(const auto &root : roots) {
+            if(root) Emit(root);
+            else Visit(0.0);
+            m_program.m_code.push_back({ OpCode::Output, static_cast<uint32_t>(m_program.m_outputs++) });
+            --m_depth;
+        }
+    }
+
+    Program Result() {
+        return std::move(m_program);
+    }
+
+private:
+    void CountUses(const Ast::NodePtr &root) {
+        std::vector<const Ast::Node *> pending;
+        if(root) pending.push_back(root.get());
+        while(!pending.empty()) {
+            const Ast::Node *node = pending.back();
+            pending.pop_back();
+            if(m_uses[node]++) continue;
+            for(const auto &arg : node->m_args) pending.push_back(arg.get());
+        }
+    }
+
+    void Emit(const Ast::NodePtr &root) {
+        std::vector<std::pair<const Ast::Node *, size_t>> pending{ { root.get(), 0 } };
+        while(!pending.empty()) {
+            auto &top = pending.back();
+            const Ast::Node *node = top.first;
+            auto slot = m_slotOf.find(node);
+            if(slot != m_slotOf.end()) {
+                Push(OpCode::Load, slot->second);
+                pending.pop_back();
+            }
+            else if(top.second < node->m_args.size()) {
+                const Ast::Node *arg = node->m_args[top.second++].get();
+                pending.emplace_back(arg, 0);
+            }
+            else {
+                node->m_token->Accept(*this);
+                if(!node->m_args.empty() && m_uses[node] > 1) StoreToSlot(node);
+                pending.pop_back();
+            }
+        }
+    }
+
+    void Visit(double num) override {
+        if(m_hoistLiterals) Push(OpCode::Parameter, m_program.m_parameters++);
+        else Push(OpCode::Constant, IndexOf(m_constantIndex, m_program.m_constants, BitsOf(num), num));
+    }
+
+    void Visit(const Variable &variable) override {
+        Push(OpCode::Variable, IndexOf(m_variableIndex, m_program.m_variables, variable.m_name, variable.m_name));
+    }
+
+    void Visit(Operator op) override {
+        const size_t arity = Ast::ArityOf(op);
+        m_program.m_code.push_back({ OpCodeOf(op), 0 });
+        m_depth -= arity - 1;
+    }
+
+    void Push(OpCode code, size_t operand) {
+        m_program.m_code.push_back({ code, static_cast<uint32_t>(operand) });
+        m_program.m_stackDepth = std::max(m_program.m_stackDepth, ++m_depth);
+    }
+
+    void StoreToSlot(const Ast::Node *node) {
+        m_slotOf[node] = m_program.m_slots;
+        m_program.m_code.push_back({ OpCode::Store, static_cast<uint32_t>(m_program.m_slots++) });
+    }
+
+    // Constants are pooled by bit pattern to keep 0 and -0 apart.
+    static uint64_t BitsOf(double num) {
+        uint64_t bits;
+        std::memcpy(&bits, &num, sizeof(bits));
+        return bits;
+    }
+
+    template<typename K, typename T> static size_t IndexOf(std::unordered_map<K, size_t> &index, std::vector<T> &pool, const K &key, const T &value) {
+        auto found = index.emplace(key, pool.size());
+        if(found.second) pool.push_back(value);
+        return found.first->second;
+    }
+
+    bool m_hoistLiterals;
+    Program m_program;
+    std::unordered_map<uint64_t, size_t> m_constantIndex;
+    std::unordered_map<std::wstring, size_t> m_variableIndex;
+    std::unordered_map<const Ast::Node *, size_t> m_uses;
+    std::unordered_map<const Ast::Node *, size_t> m_slotOf;
+    size_t m_depth = 0;
+};
+} // namespace Detail
+
+// Compile the expression tree to a program, computing equal subtrees only once.
+inline Program Compile(const Ast::NodePtr &root) {
+    Detail::ProgramBuilder builder(Ast::ShareCommonSubtrees(root), false);
+    return builder.Result();
+}
+
+// Compile several trees to one program that computes all of them in a single pass.
+inline Program Compile(const Ast::Nodes &roots) {
+    Detail::ProgramBuilder builder(Ast::ShareCommonSubtrees(roots));
+    return builder.Result();
+}
+
+// Compile several sequences of tokens in postfix notation, each optimized with the options.
+inline Program Compile(const std::vector<Tokens> &formulas, const Optimizer::Options &options = {}, Optimizer::Statistics *statistics = nullptr) {
+    Ast::Nodes roots;
+    roots.reserve(formulas.size());
+    for(const auto &tokens : formulas) roots.push_back(Optimizer::Optimize(Ast::Build(tokens), options, statistics));
+    return Compile(roots);
+}
+
+// Compile the tree with every literal replaced by the next parameter in postfix order.
+// Literals are never shared, so the program is valid for any values of them.
+inline Program CompileShape(const Ast::NodePtr &root) {
+    Detail::ProgramBuilder builder(Ast::ShareCommonSubtrees(root, false), true);
+    return builder.Result();
+}
+
+// Compile the sequence of tokens in postfix notation to a program optimized with the options.
+inline Program Compile(const Tokens &tokens, const Optimizer::Options &options = {}, Optimizer::Statistics *statistics = nullptr) {
+    return Compile(Optimizer::Optimize(Ast::Build(tokens), options, statistics));
+}
+
+// Expression tree computed by the program, found by running it on a stack of subtrees.
+// Fixed variables and parameters become literals, stored values are shared nodes.
+inline Ast::NodePtr Decompile(const Program &program, const Bindings &fixed = {}, const std::vector<double> &parameters = {}) {
+    if(parameters.size() != program.Parameters()) throw std::logic_error("Wrong number of parameters.");
+    Ast::Nodes variables, stack, slots(program.Slots());
+    for(const auto &name : program.Variables()) {
+        auto value = fixed.find(name);
+        variables.push_back(value == fixed.end() ? Ast::MakeLeaf(Variable{ name }) : Ast::MakeLeaf(value->second));
+    }
+    for(const auto &instruction : program.Code()) {
+        switch(instruction.m_code) {
+            case OpCode::Constant: stack.push_back(Ast::MakeLeaf(program.Constants()[instruction.m_operand])); break;
+            case OpCode::Variable: stack.push_back(variables[instruction.m_operand]); break;
+            case OpCode::Parameter: stack.push_back(Ast::MakeLeaf(parameters[instruction.m_operand])); break;
+            case OpCode::Store: slots[instruction.m_operand] = stack.back(); break;
+            case OpCode::Load: stack.push_back(slots[instruction.m_operand]); break;
+            case OpCode::Output: throw std::logic_error("Program has several outputs.");
+            default: {
+                const Operator op = Detail::OperatorOf(instruction.m_code);
+                const size_t arity = Ast::ArityOf(op);
+                Ast::Nodes args(stack.end() - arity, stack.end());
+                stack.erase(stack.end() - arity, stack.end());
+                stack.push_back(Ast::MakeNode(MakeToken(op), std::move(args)));
+            }
+        }
+    }
+    return stack.empty() ? nullptr : stack.back();
+}
+
+// Program over the variables that are not fixed, with everything that depends only on
+// the fixed ones computed once here instead of on every evaluation.
+inline Program Specialize(const Program &program, const Bindings &fixed, const Optimizer::Options &options = {}) {
+    return Compile(Optimizer::Optimize(Decompile(program, fixed), options));
+}
+
+// Program of the shape with values of the literals of one expression.
+struct Prepared {
+    double Evaluate(const Bindings &bindings = {}) const {
+        return m_program->Evaluate(bindings, m_parameters);
+    }
+
+    std::shared_ptr<const Program> m_program;
+    std::vector<double> m_parameters;
+};
+
+// Program specialized for the fixed variables with the literals of the expression.
+inline Program Specialize(const Prepared &prepared, const Bindings &fixed, const Optimizer::Options &options = {}) {
+    return Compile(Optimizer::Optimize(Decompile(*prepared.m_program, fixed, prepared.m_parameters), options));
+}
+
+// Programs by shape, expressions that differ only in literals share one program.
+class ShapeRegistry {
+public:
+    // Constants are folded first, which depends only on where literals are, never on their values.
+    Prepared Prepare(const Tokens &tokens) {
+        const Tokens folded = Optimizer::FoldConstants(tokens);
+        auto &program = m_programs[Canonical::ShapeOf(folded)];
+        if(!program) program = std::make_shared<const Program>(CompileShape(Ast::Build(folded)));
+        Prepared prepared{ program, {} };
+        for(const auto &token : folded) {
+            if(const double *num = PayloadOf<double>(token)) prepared.m_parameters.push_back(*num);
+        }
+        return prepared;
+    }
+
+    size_t Size() const {
+        return m_programs.size();
+    }
+
+private:
+    std::unordered_map<Canonical::Key, std::shared_ptr<const Program>, Canonical::KeyHash> m_programs;
+};
+} // namespace Compiler
+} // namespace Interpreter
@@ -0,0 +1,239 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Compiler.h"
+#include <atomic>
+#include <thread>
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+using Compiler::OpCode;
+
+TEST_CLASS(CompilerTests) {
+public:
+    TEST_METHOD(Should_return_zero_when_evaluate_empty_program) {
+        Compiler::Program program = Compiler::Compile(Tokens{});
+        Assert::AreEqual(0.0, program.Evaluate());
+    }
+
+    TEST_METHOD(Should_compile_expression_to_same_value_as_evaluator) {
+        // (4+1)*2/(4/(3-1))
+        Tokens tokens{ _4, _1, plus, _2, mul, _4, _3, _1, minus, div, div };
+        Compiler::Program program = Compiler::Compile(Ast::Build(tokens));
+        Assert::AreEqual(Evaluator::Evaluate(tokens), program.Evaluate());
+    }
+
+    TEST_METHOD(Should_fold_constants_when_compile_tokens) {
+        Compiler::Program program = Compiler::Compile({ _2, _3, mul, uMinus });
+        Assert::AreEqual(size_t(1), program.Code().size());
+        Assert::AreEqual(-6.0, program.Evaluate());
+    }
+
+    TEST_METHOD(Should_evaluate_variables_by_name_and_by_index) {
+        Compiler::Program program = Compiler::Compile({ a, b, minus });
+        Assert::AreEqual(3.0, program.Evaluate({ { L"a", 5 }, { L"b", 2 } }));
+        Assert::AreEqual(-3.0, program.Evaluate(std::vector<double>{ 2, 5 }));
+    }
+
+    TEST_METHOD(Should_throw_when_variable_is_not_bound) {
+        Compiler::Program program = Compiler::Compile({ a, _1, plus });
+        Assert::ExpectException<std::logic_error>([&program]() { program.Evaluate(); });
+    }
+
+    TEST_METHOD(Should_compute_common_subexpression_once) {
+        // (a+b)*(a+b)/(a+b)
+        Compiler::Program program = Compiler::Compile({ a, b, plus, a, b, plus, mul, a, b, plus, div });
+        const auto &code = program.Code();
+        Assert::AreEqual(size_t(1), program.Slots());
+        Assert::AreEqual(1, int(std::count_if(code.cbegin(), code.cend(), [](const Compiler::Instruction &i) { return i.m_code == OpCode::Add; })));
+        Assert::AreEqual(2, int(std::count_if(code.cbegin(), code.cend(), [](const Compiler::Instruction &i) { return i.m_code == OpCode::Load; })));
+        Assert::AreEqual(5.0, program.Evaluate({ { L"a", 2 }, { L"b", 3 } }));
+    }
+
+    TEST_METHOD(Should_share_variables_and_constants_in_pools) {
+        Compiler::Program program = Compiler::Compile({ a, _3, mul, a, _3, div, plus });
+        Assert::AreEqual(size_t(1), program.Variables().size());
+        Assert::AreEqual(size_t(1), program.Constants().size());
+    }
+
+    TEST_METHOD(Should_compile_fused_multiply_add) {
+        Optimizer::Options options;
+        options.m_mode = Optimizer::Mode::FastMath;
+        options.m_fuseMultiplyAdd = true;
+        Compiler::Program program = Compiler::Compile({ a, b, mul, x, plus }, options);
+        Assert::AreEqual(size_t(4), program.Code().size());
+        Assert::AreEqual(7.0, program.Evaluate({ { L"a", 2 }, { L"b", 3 }, { L"x", 1 } }));
+    }
+
+    TEST_METHOD(Should_track_maximum_stack_depth) {
+        // 1-(2-(3-a)) = 1 2 3 a - - -
+        Compiler::Program program = Compiler::Compile({ _1, _2, _3, a, minus, minus, minus });
+        Assert::AreEqual(size_t(4), program.StackDepth());
+    }
+};
+
+TEST_CLASS(ShapeTests) {
+public:
+    TEST_METHOD(Should_share_program_for_expressions_differing_in_literals) {
+        Compiler::ShapeRegistry registry;
+        Compiler::Prepared first = registry.Prepare(Postfix(L"x*1.05"));
+        Compiler::Prepared second = registry.Prepare(Postfix(L"x*1.07"));
+        Assert::IsTrue(first.m_program == second.m_program);
+        Assert::AreEqual(size_t(1), registry.Size());
+        Assert::AreEqual(2 * 1.05, first.Evaluate({ { L"x", 2 } }));
+        Assert::AreEqual(2 * 1.07, second.Evaluate({ { L"x", 2 } }));
+    }
+
+    TEST_METHOD(Should_fold_literals_to_one_parameter) {
+        Compiler::ShapeRegistry registry;
+        Compiler::Prepared prepared = registry.Prepare(Postfix(L"x*(2+3)"));
+        Assert::AreEqual(size_t(1), prepared.m_program->Parameters());
+        Assert::AreEqual(10.0, prepared.Evaluate({ { L"x", 2 } }));
+    }
+
+    TEST_METHOD(Should_not_share_equal_literals_within_shape) {
+        Compiler::ShapeRegistry registry;
+        Compiler::Prepared same = registry.Prepare(Postfix(L"x*2 + x*2"));
+        Compiler::Prepared different = registry.Prepare(Postfix(L"x*2 + x*3"));
+        Assert::IsTrue(same.m_program == different.m_program);
+        Assert::AreEqual(2.0 * 1 + 2.0 * 1, same.Evaluate({ { L"x", 1 } }));
+        Assert::AreEqual(2.0 * 1 + 3.0 * 1, different.Evaluate({ { L"x", 1 } }));
+    }
+
+    TEST_METHOD(Should_compile_different_shapes_separately) {
+        Compiler::ShapeRegistry registry;
+        registry.Prepare(Postfix(L"x*2"));
+        registry.Prepare(Postfix(L"2*x"));
+        registry.Prepare(Postfix(L"x*2 + a"));
+        Assert::AreEqual(size_t(3), registry.Size());
+    }
+
+    TEST_METHOD(Should_throw_when_parameters_are_missing) {
+        Compiler::Program program = Compiler::CompileShape(Ast::Build({ x, _2, mul }));
+        Assert::ExpectException<std::logic_error>([&program]() { program.Evaluate(std::vector<double>{ 1 }); });
+        Assert::AreEqual(6.0, program.Evaluate(std::vector<double>{ 2 }, { 3 }));
+    }
+};
+
+TEST_CLASS(SpecializationTests) {
+public:
+    TEST_METHOD(Should_decompile_program_to_shared_tree) {
+        Tokens tokens = Postfix(L"(a+b)*(a+b) - x");
+        Ast::NodePtr root = Compiler::Decompile(Compiler::Compile(tokens));
+        Assert::IsTrue(Ast::Equal(Ast::Build(tokens), root));
+        Assert::AreEqual(size_t(6), Ast::CountNodes(root));
+    }
+
+    TEST_METHOD(Should_fold_fixed_variables) {
+        Compiler::Program program = Compiler::Compile(Postfix(L"(a + 2) * x"));
+        Compiler::Program specialized = Compiler::Specialize(program, { { L"a", 3 } });
+        Assert::AreEqual(size_t(1), specialized.Variables().size());
+        Assert::AreEqual(size_t(3), specialized.Code().size());
+        Assert::AreEqual(program.Evaluate({ { L"a", 3 }, { L"x", 7 } }), specialized.Evaluate({ { L"x", 7 } }));
+    }
+
+    TEST_METHOD(Should_simplify_after_fixing_variables) {
+        Compiler::Program specialized = Compiler::Specialize(Compiler::Compile(Postfix(L"x * a - b")), { { L"a", 1 }, { L"b", 0 } });
+        Assert::AreEqual(size_t(1), specialized.Code().size());
+        Assert::AreEqual(5.0, specialized.Evaluate({ { L"x", 5 } }));
+    }
+
+    TEST_METHOD(Should_keep_value_when_nothing_is_fixed) {
+        const Bindings bindings{ { L"a", 0.1 }, { L"b", 0.7 }, { L"x", 3 } };
+        Compiler::Program program = Compiler::Compile(Postfix(L"a*x + b/(x - a) - -b"));
+        Assert::AreEqual(program.Evaluate(bindings), Compiler::Specialize(program, {}).Evaluate(bindings));
+    }
+
+    TEST_METHOD(Should_specialize_prepared_shape) {
+        Compiler::ShapeRegistry registry;
+        Compiler::Prepared prepared = registry.Prepare(Postfix(L"x*1.05 + a*2"));
+        Compiler::Program specialized = Compiler::Specialize(prepared, { { L"a", 4 } });
+        Assert::AreEqual(size_t(0), specialized.Parameters());
+        Assert::AreEqual(prepared.Evaluate({ { L"a", 4 }, { L"x", 3 } }), specialized.Evaluate({ { L"x", 3 } }));
+    }
+};
+
+TEST_CLASS(MultipleOutputTests) {
+public:
+    TEST_METHOD(Should_evaluate_all_formulas_in_one_pass) {
+        Compiler::Program program = Compiler::Compile(std::vector<Tokens>{ Postfix(L"a+b"), Postfix(L"a*b"), Postfix(L"2") });
+        Assert::AreEqual(size_t(3), program.Outputs());
+        auto results = program.EvaluateAll({ { L"a", 2 }, { L"b", 3 } });
+        Assert::AreEqual(size_t(3), results.size());
+        Assert::AreEqual(5.0, results[0]);
+        Assert::AreEqual(6.0, results[1]);
+        Assert::AreEqual(2.0, results[2]);
+    }
+
+    TEST_METHOD(Should_compute_subexpression_common_to_formulas_once) {
+        Compiler::Program program = Compiler::Compile(std::vector<Tokens>{ Postfix(L"(a+b)*x"), Postfix(L"(a+b)/x"), Postfix(L"a+b") });
+        const auto &code = program.Code();
+        Assert::AreEqual(1, int(std::count_if(code.cbegin(), code.cend(), [](const Compiler::Instruction &i) { return i.m_code == OpCode::Add; })));
+        auto results = program.EvaluateAll({ { L"a", 1 }, { L"b", 3 }, { L"x", 2 } });
+        Assert::AreEqual(8.0, results[0]);
+        Assert::AreEqual(2.0, results[1]);
+        Assert::AreEqual(4.0, results[2]);
+    }
+
+    TEST_METHOD(Should_throw_when_evaluate_one_result_of_several) {
+        Compiler::Program program = Compiler::Compile(std::vector<Tokens>{ Postfix(L"a"), Postfix(L"b") });
+        Assert::ExpectException<std::logic_error>([&program]() { program.Evaluate({ { L"a", 1 }, { L"b", 2 } }); });
+    }
+
+    TEST_METHOD(Should_return_only_result_of_single_formula) {
+        Compiler::Program program = Compiler::Compile(Postfix(L"a-1"));
+        auto results = program.EvaluateAll({ { L"a", 3 } });
+        Assert::AreEqual(size_t(1), results.size());
+        Assert::AreEqual(2.0, results[0]);
+    }
+};
+
+TEST_CLASS(ScratchTests) {
+public:
+    TEST_METHOD(Should_reuse_scratch_for_different_programs) {
+        Compiler::Scratch scratch;
+        Compiler::Program deep = Compiler::Compile(Postfix(L"1-(2-(3-(x-(a-b))))"));
+        Compiler::Program shallow = Compiler::Compile(Postfix(L"(a+b)*(a+b)"));
+        Assert::AreEqual(deep.Evaluate(std::vector<double>{ 4, 5, 6 }), deep.Evaluate(std::vector<double>{ 4, 5, 6 }, scratch));
+        Assert::AreEqual(81.0, shallow.Evaluate(std::vector<double>{ 4, 5 }, scratch));
+    }
+
+    TEST_METHOD(Should_evaluate_bindings_in_scratch) {
+        Compiler::Scratch scratch;
+        Compiler::Program program = Compiler::Compile(Postfix(L"(a+b)*(a+b) - x/3"));
+        const Bindings bindings{ { L"a", 1 }, { L"b", 2 }, { L"x", 6 } };
+        Assert::AreEqual(program.Evaluate(bindings), program.Evaluate(bindings, scratch));
+        Compiler::Program outputs = Compiler::Compile(std::vector<Tokens>{ Postfix(L"a+1"), Postfix(L"a*b") });
+        std::vector<double> results;
+        outputs.EvaluateAll(bindings, scratch, results);
+        Assert::AreEqual(size_t(2), results.size());
+        Assert::AreEqual(2.0, results[1]);
+        Assert::ExpectException<std::logic_error>([&]() { program.Evaluate({ { L"a", 1 } }, scratch); });
+    }
+
+    TEST_METHOD(Should_start_scratch_at_cache_line) {
+        Compiler::Scratch scratch;
+        for(size_t count : { 1, 7, 9, 100 }) {
+            Assert::AreEqual(size_t(0), size_t(reinterpret_cast<uintptr_t>(scratch.Reserve(count)) % 64));
+        }
+    }
+
+    TEST_METHOD(Should_evaluate_one_program_from_many_threads) {
+        const Compiler::Program program = Compiler::Compile(Postfix(L"(x+1)*(x+1) - x/3"));
+        std::vector<std::thread> threads;
+        std::atomic<int> wrong{ 0 };
+        for(int t = 0; t < 8; ++t) {
+            threads.emplace_back([&program, &wrong, t]() {
+                Compiler::Scratch scratch;
+                for(int i = 0; i < 1000; ++i) {
+                    const double x = t * 1000 + i;
+                    if(program.Evaluate(std::vector<double>{ x }, scratch) != (x + 1) * (x + 1) - x / 3) ++wrong;
+                }
+            });
+        }
+        for(auto &thread : threads) thread.join();
+        Assert::AreEqual(0, wrong.load());
+    }
+};
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <vector>
+
+namespace Interpreter {
+namespace Epoch {
+
+class Reader;
+
+// Frees objects that readers find without any lock once none of them can see the object
+// anymore. Each reader announces the epoch it entered its critical section in, and an
+// object retired in an epoch is freed when no reader is inside since that epoch or earlier.
+class Domain {
+public:
+    Domain() = default;
+    Domain(const Domain &) = delete;
+    Domain &operator=(const Domain &) = delete;
+
+    // Readers must be gone, every retired object is freed.
+    ~Domain() {
+        for(const auto &retired : m_retired) retired.m_delete(retired.m_object);
+    }
+
+    // Delete the object once no reader can see it, it must already be unlinked from where readers find it.
+    template<typename T> void Retire(const T *object) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_retired.push_back({ object, [](const void *retired) { delete static_cast<const T *>(retired); }, m_epoch.fetch_add(1) });
+    }
+
+    // Free objects no reader can see anymore.
+    void Collect() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t oldest = UINT64_MAX;
+        for(const auto &record : m_readers) {
+            const uint64_t epoch = record.m_epoch.load();
+            if(epoch) oldest = std::min(oldest, epoch);
+        }
+        auto released = std::stable_partition(m_retired.begin(), m_retired.end(), [oldest](const RetiredObject &retired) { return retired.m_epoch >= oldest; });
+        for(auto retired = released; retired != m_retired.end(); ++retired) retired->m_delete(retired->m_object);
+        m_retired.erase(released, m_retired.end());
+    }
+
+    // Objects waiting for readers to leave.
+    size_t Retired() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_retired.size();
+    }
+
+private:
+    friend class Reader;
+
+    // Each reader stores its epoch twice per critical section, a line of its own keeps readers
+    // on different threads from invalidating each other.
+    struct alignas(64) Record {
+        std::atomic<uint64_t> m_epoch{ 0 };
+    };
+
+    struct RetiredObject {
+        const void *m_object;
+        void (*m_delete)(const void *);
+        uint64_t m_epoch;
+    };
+
+    Record &Register() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_readers.emplace_back();
+        return m_readers.back();
+    }
+
+    void Unregister(Record &record) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_readers.remove_if([&record](const Record &candidate) { return &candidate == &record; });
+    }
+
+    mutable std::mutex m_mutex;
+    std::vector<RetiredObject> m_retired;
+    std::list<Record> m_readers;
+    std::atomic<uint64_t> m_epoch{ 1 };
+};
+
+// Reader of the domain used by one thread at a time. Creating and destroying a reader takes
+// the lock of the domain, reading never does.
+class Reader {
+public:
+    explicit Reader(Domain &domain) : m_domain(domain), m_record(domain.Register()) {}
+
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    ~Reader() {
+        m_domain.Unregister(m_record);
+    }
+
+    // Call read() in a critical section, objects retired meanwhile stay alive until it returns.
+    // Reads may nest, the epoch of the outermost one protects the objects of all of them.
+    template<typename F> auto Read(F read) -> decltype(read()) {
+        struct Exit {
+            ~Exit() {
+                if(--m_reader.m_depth == 0) m_reader.m_record.m_epoch.store(0);
+            }
+            Reader &m_reader;
+        } exit{ *this };
+        if(m_depth++ == 0) m_record.m_epoch.store(m_domain.m_epoch.load());
+        return read();
+    }
+
+private:
+    Domain &m_domain;
+    Domain::Record &m_record;
+    size_t m_depth = 0;
+};
+} // namespace Epoch
+} // namespace Interpreter
@@ -0,0 +1,64 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Epoch.h"
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(EpochTests) {
+public:
+    struct Counted {
+        explicit Counted(int &alive) : m_alive(alive) {
+            ++m_alive;
+        }
+        ~Counted() {
+            --m_alive;
+        }
+        int &m_alive;
+    };
+
+    TEST_METHOD(Should_free_retired_object_after_reader_leaves) {
+        int alive = 0;
+        Epoch::Domain domain;
+        Epoch::Reader reader(domain);
+        reader.Read([&]() {
+            domain.Retire(new Counted(alive));
+            domain.Collect();
+            Assert::AreEqual(1, alive);
+            return 0;
+        });
+        domain.Collect();
+        Assert::AreEqual(0, alive);
+        Assert::AreEqual(size_t(0), domain.Retired());
+    }
+
+    TEST_METHOD(Should_keep_object_retired_in_nested_read) {
+        int alive = 0;
+        Epoch::Domain domain;
+        Epoch::Reader reader(domain);
+        reader.Read([&]() {
+            reader.Read([&]() {
+                domain.Retire(new Counted(alive));
+                return 0;
+            });
+            domain.Collect();
+            Assert::AreEqual(1, alive);
+            return 0;
+        });
+        domain.Collect();
+        Assert::AreEqual(0, alive);
+    }
+
+    TEST_METHOD(Should_free_retired_objects_with_domain) {
+        int alive = 0;
+        {
+            Epoch::Domain domain;
+            domain.Retire(new Counted(alive));
+            domain.Retire(new Counted(alive));
+            Assert::AreEqual(2, alive);
+        }
+        Assert::AreEqual(0, alive);
+    }
+};
+
+}
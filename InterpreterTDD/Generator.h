@@ -0,0 +1,195 @@
+#pragma once
+#include "Interpreter.h"
+#include <fstream>
+#include <random>
+
+namespace Interpreter {
+namespace Generator {
+
+enum class Literals {
+    Integers,   // 1 to 99
+    Decimals,   // 0.001 to 999.999
+    Scientific  // 1.0e-9 to 9.9e9
+};
+
+struct Options {
+    uint64_t m_seed = 1;
+    // Tokens in the expression, reached at the end of an operand, so a few more can follow.
+    size_t m_tokens = 100;
+    // Deepest nesting of parentheses.
+    size_t m_maxDepth = 16;
+    // Relative weights of the binary operators + - * /.
+    double m_operators[4] = { 1, 1, 1, 1 };
+    // Chance of a unary + or - before an operand.
+    double m_unary = 0.1;
+    // Chance that an operand opens parentheses, and the mean number of operands inside them.
+    double m_parentheses = 0.2;
+    double m_groupOperands = 4;
+    // Chance that an operand is a variable instead of a literal.
+    double m_variables = 0.2;
+    std::vector<std::wstring> m_names = { L"x", L"y", L"z" };
+    Literals m_literals = Literals::Decimals;
+};
+
+// Valid expressions in infix notation, the same for the same seed on every platform: only the
+// raw bits of mt19937_64 are used, mapped to numbers here rather than by the library
+// distributions whose results differ between implementations. Generation is a loop, so the
+// size is bounded by memory only.
+class ExpressionGenerator {
+public:
+    explicit ExpressionGenerator(Options options) : m_options(std::move(options)), m_engine(m_options.m_seed) {}
+
+    std::wstring Next() {
+        std::wstring expression;
+        Generate([&expression](const std::wstring &piece) { expression += piece; });
+        return expression;
+    }
+
+    // Pass the next expression to sink(piece) in pieces, for expressions too big to keep.
+    template<typename Sink> void Generate(Sink &&sink) {
+        std::wstring buffer;
+        size_t tokens = 0, depth = 0;
+        std::vector<size_t> groups;
+        const double operators = m_options.m_operators[0] + m_options.m_operators[1] + m_options.m_operators[2] + m_options.m_operators[3];
+        for(;;) {
+            if(Uniform() < m_options.m_unary) {
+                buffer += Below(2) ? L'-' : L'+';
+                ++tokens;
+            }
+            if(depth < m_options.m_maxDepth && tokens < m_options.m_tokens && Uniform() < m_options.m_parentheses) {
+                buffer += L'(';
+                ++tokens;
+                ++depth;
+                continue;
+            }
+            AppendOperand(buffer);
+            ++tokens;
+            while(depth > 0 && (tokens >= m_options.m_tokens || Uniform() * m_options.m_groupOperands < 1)) {
+                buffer += L')';
+                ++tokens;
+                --depth;
+            }
+            if(tokens >= m_options.m_tokens && depth == 0) break;
+            buffer += OperatorAt(Uniform() * operators);
+            ++tokens;
+            if(buffer.size() >= 1 << 16) {
+                sink(buffer);
+                buffer.clear();
+            }
+        }
+        sink(buffer);
+    }
+
+    // Raw 64 bits of the engine.
+    uint64_t Bits() {
+        return m_engine();
+    }
+
+    // Uniform in [0, 1) from the upper 53 bits.
+    double Uniform() {
+        return (Bits() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // Uniform in [0, bound), rejecting the top values that would favor small results.
+    uint64_t Below(uint64_t bound) {
+        const uint64_t limit = UINT64_MAX - UINT64_MAX % bound;
+        uint64_t bits;
+        do bits = Bits();
+        while(bits >= limit);
+        return bits % bound;
+    }
+
+private:
+    wchar_t OperatorAt(double weight) const {
+        static const wchar_t symbols[] = { L'+', L'-', L'*', L'/' };
+        for(int i = 0; i < 3; ++i) {
+            if(weight < m_options.m_operators[i]) return symbols[i];
+            weight -= m_options.m_operators[i];
+        }
+        return symbols[3];
+    }
+
+    void AppendOperand(std::wstring &buffer) {
+        if(!m_options.m_names.empty() && Uniform() < m_options.m_variables) {
+            buffer += m_options.m_names[Below(m_options.m_names.size())];
+            return;
+        }
+        switch(m_options.m_literals) {
+            case Literals::Integers:
+                buffer += std::to_wstring(1 + Below(99));
+                break;
+            case Literals::Decimals:
+                buffer += std::to_wstring(Below(1000)) + L'.' + Digits(1 + Below(999), 3);
+                break;
+            case Literals::Scientific:
+                buffer += std::to_wstring(1 + Below(9)) + L'.' + Digits(Below(10), 1) + L'e' + std::to_wstring(int(Below(19)) - 9);
+                break;
+        }
+    }
+
+    static std::wstring Digits(uint64_t value, size_t count) {
+        std::wstring digits = std::to_wstring(value);
+        return std::wstring(count - std::min(count, digits.size()), L'0') + digits;
+    }
+
+    Options m_options;
+    std::mt19937_64 m_engine;
+};
+
+// Write count expressions, one per line, with the generator of the options.
+inline void WriteCorpus(const std::string &path, const Options &options, size_t count) {
+    std::ofstream file(path, std::ios::binary);
+    if(!file) throw std::runtime_error("Can't write corpus file.");
+    ExpressionGenerator generator(options);
+    std::string line;
+    for(size_t i = 0; i < count; ++i) {
+        generator.Generate([&](const std::wstring &piece) {
+            line.assign(piece.begin(), piece.end());
+            file << line;
+        });
+        file << '\n';
+    }
+    if(!file) throw std::runtime_error("Can't write corpus file.");
+}
+
+struct Corpus {
+    std::string m_name;
+    Options m_options;
+    size_t m_count;
+};
+
+// Corpora with fixed seeds shared by the benchmarks and the differential tests.
+inline std::vector<Corpus> CannedCorpora() {
+    std::vector<Corpus> corpora(5);
+    corpora[0].m_name = "short";
+    corpora[0].m_options.m_tokens = 10;
+    corpora[0].m_count = 100000;
+
+    corpora[1].m_name = "medium";
+    corpora[1].m_options.m_seed = 2;
+    corpora[1].m_options.m_tokens = 1000;
+    corpora[1].m_count = 1000;
+
+    corpora[2].m_name = "nested";
+    corpora[2].m_options.m_seed = 3;
+    corpora[2].m_options.m_tokens = 10000;
+    corpora[2].m_options.m_maxDepth = 256;
+    corpora[2].m_options.m_parentheses = 0.5;
+    corpora[2].m_options.m_groupOperands = 8;
+    corpora[2].m_count = 100;
+
+    corpora[3].m_name = "unary";
+    corpora[3].m_options.m_seed = 4;
+    corpora[3].m_options.m_unary = 0.6;
+    corpora[3].m_options.m_literals = Literals::Integers;
+    corpora[3].m_count = 10000;
+
+    corpora[4].m_name = "large";
+    corpora[4].m_options.m_seed = 5;
+    corpora[4].m_options.m_tokens = 10000000;
+    corpora[4].m_options.m_literals = Literals::Scientific;
+    corpora[4].m_count = 1;
+    return corpora;
+}
+} // namespace Generator
+} // namespace Interpreter
@@ -0,0 +1,90 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Generator.h"
+#include "Compiler.h"
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(GeneratorTests) {
+public:
+    static size_t Depth(const std::wstring &expression) {
+        size_t depth = 0, deepest = 0;
+        for(wchar_t ch : expression) {
+            if(ch == L'(') deepest = std::max(deepest, ++depth);
+            if(ch == L')') --depth;
+        }
+        return deepest;
+    }
+
+    TEST_METHOD(Should_generate_same_expressions_for_same_seed) {
+        Generator::Options options;
+        Generator::ExpressionGenerator first(options), second(options);
+        for(int i = 0; i < 10; ++i) Assert::AreEqual(first.Next(), second.Next());
+        options.m_seed = 2;
+        Assert::AreNotEqual(Generator::ExpressionGenerator(Generator::Options()).Next(), Generator::ExpressionGenerator(options).Next());
+    }
+
+    TEST_METHOD(Should_map_engine_bits_the_same_on_every_platform) {
+        Generator::ExpressionGenerator generator(Generator::Options{});
+        Assert::AreEqual(uint64_t(2469588189546311528), generator.Bits());
+        Assert::AreEqual(0.13640703636619722, generator.Uniform());
+        Assert::AreEqual(uint64_t(0), generator.Below(10));
+    }
+
+    TEST_METHOD(Should_generate_expressions_of_requested_size_and_depth) {
+        Generator::Options options;
+        options.m_tokens = 5000;
+        options.m_maxDepth = 3;
+        options.m_parentheses = 0.5;
+        Generator::ExpressionGenerator generator(options);
+        for(int i = 0; i < 5; ++i) {
+            const std::wstring expression = generator.Next();
+            Assert::IsTrue(Lexer::Tokenize(expression).size() >= 5000);
+            Assert::IsTrue(Depth(expression) <= 3);
+        }
+    }
+
+    TEST_METHOD(Should_generate_only_selected_operators_and_literals) {
+        Generator::Options options;
+        options.m_operators[1] = options.m_operators[3] = 0;
+        options.m_unary = 0;
+        options.m_variables = 0;
+        options.m_literals = Generator::Literals::Integers;
+        const std::wstring expression = Generator::ExpressionGenerator(options).Next();
+        Assert::AreEqual(std::wstring::npos, expression.find_first_of(L"-/.xyz"));
+    }
+
+    TEST_METHOD(Should_evaluate_generated_expressions_same_as_compiled_programs) {
+        for(const auto &corpus : Generator::CannedCorpora()) {
+            if(corpus.m_options.m_tokens > 10000) continue;
+            Generator::ExpressionGenerator generator(corpus.m_options);
+            const Bindings bindings{ { L"x", 0.5 }, { L"y", -3 }, { L"z", 7 } };
+            for(int i = 0; i < 20; ++i) {
+                const Tokens tokens = Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(generator.Next())));
+                const double expected = Evaluator::Evaluate(tokens, bindings);
+                const double compiled = Compiler::Compile(tokens).Evaluate(bindings);
+                Assert::IsTrue(expected == compiled || (std::isnan(expected) && std::isnan(compiled)));
+            }
+        }
+    }
+
+    TEST_METHOD(Should_write_one_expression_per_line) {
+        const std::string path = "GeneratorTests.corpus";
+        Generator::Options options;
+        options.m_tokens = 20;
+        Generator::WriteCorpus(path, options, 3);
+        std::ifstream file(path);
+        Generator::ExpressionGenerator generator(options);
+        std::string line;
+        for(int i = 0; i < 3; ++i) {
+            Assert::IsTrue(bool(std::getline(file, line)));
+            const std::wstring expected = generator.Next();
+            Assert::IsTrue(std::wstring(line.begin(), line.end()) == expected);
+        }
+        file.close();
+        std::remove(path.c_str());
+    }
+};
+
+}
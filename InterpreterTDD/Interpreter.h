@@ -1,14 +1,18 @@
-#pragma once;
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <cwctype>
 #include <vector>
 #include <algorithm>
 #include <functional>
 #include <unordered_map>
 #include <memory>
+#include <cmath>
 
 namespace Interpreter {
 
 enum class Operator {
-    Plus, Minus, Mul, Div, LParen, RParen, UPlus, UMinus,
+    Plus, Minus, Mul, Div, LParen, RParen, UPlus, UMinus, FusedMulAdd,
 };
 
 inline std::wstring ToString(const Operator &op) {
@@ -16,7 +20,8 @@ inline std::wstring ToString(const Operator &op) {
             { Operator::Plus, L"+" }, { Operator::Minus, L"-" },
             { Operator::Mul, L"*" }, { Operator::Div, L"/" },
             { Operator::LParen, L"(" }, { Operator::RParen, L")" },
-            { Operator::UPlus, L"u+" }, { Operator::UMinus, L"u-" } };
+            { Operator::UPlus, L"u+" }, { Operator::UMinus, L"u-" },
+            { Operator::FusedMulAdd, L"fma" } };
     return opmap.at(op);
 }
 
@@ -24,6 +29,33 @@ inline std::wstring ToString(const double &num) {
     return std::to_wstring(num);
 }
 
+struct Variable {
+    std::wstring m_name;
+};
+
+inline bool operator==(const Variable &left, const Variable &right) {
+    return left.m_name == right.m_name;
+}
+
+inline std::wstring ToString(const Variable &variable) {
+    return variable.m_name;
+}
+
+inline size_t HashOf(Operator op) {
+    return std::hash<int>()(static_cast<int>(op));
+}
+
+inline size_t HashOf(double num) {
+    return std::hash<double>()(num);
+}
+
+inline size_t HashOf(const Variable &variable) {
+    return std::hash<std::wstring>()(variable.m_name);
+}
+
+// Values of the variables by name.
+typedef std::unordered_map<std::wstring, double> Bindings;
+
 struct TokenVisitor {
     template<typename Iter> void VisitAll(Iter first, Iter last) {
         std::for_each(first, last, [this](const auto &token) { token->Accept(*this); });
@@ -32,6 +64,7 @@ struct TokenVisitor {
     virtual ~TokenVisitor() {}
     virtual void Visit(double) = 0;
     virtual void Visit(Operator) = 0;
+    virtual void Visit(const Variable &) = 0;
 };
 
 namespace Detail {
@@ -41,6 +74,7 @@ struct TokenConcept {
     virtual void Accept(TokenVisitor &) const = 0;
     virtual std::wstring ToString() const = 0;
     virtual bool DispatchEquals(const TokenConcept &) const = 0;
+    virtual size_t Hash() const = 0;
 
     virtual bool EqualsTo(double) const {
         return false;
@@ -49,6 +83,10 @@ struct TokenConcept {
     virtual bool EqualsTo(Operator) const {
         return false;
     }
+
+    virtual bool EqualsTo(Variable) const {
+        return false;
+    }
 };
 
 typedef std::shared_ptr<const TokenConcept> Token;
@@ -84,6 +122,10 @@ template<typename T> struct GenericToken : TokenConcept {
         return other.EqualsTo(m_payload);
     }
 
+    size_t Hash() const override {
+        return HashOf(m_payload);
+    }
+
     T m_payload;
 };
 } // namespace Detail
@@ -99,6 +141,16 @@ inline Token MakeToken(double value) {
     return std::make_shared<Detail::GenericToken<double>>(value);
 }
 
+inline Token MakeToken(Variable value) {
+    return std::make_shared<Detail::GenericToken<Variable>>(std::move(value));
+}
+
+// Get the payload of the token when it holds a value of the given type, otherwise nullptr.
+template<typename T> const T *PayloadOf(const Token &token) {
+    auto generic = dynamic_cast<const Detail::GenericToken<T> *>(token.get());
+    return generic ? &generic->m_payload : nullptr;
+}
+
 class WithTokensResult {
 public:
     Tokens Result() {
@@ -130,6 +182,9 @@ public:
             if(IsNumber()) {
                 ScanNumber();
             }
+            else if(IsIdentifier()) {
+                ScanIdentifier();
+            }
             else if(IsOperator()) {
                 ScanOperator();
             }
@@ -148,6 +203,20 @@ private:
         AddToResult(wcstod(m_current, const_cast<wchar_t **>(&m_current)));
     }
 
+    static bool IsIdentifierChar(wchar_t ch) {
+        return iswalnum(ch) != 0 || ch == L'_';
+    }
+
+    bool IsIdentifier() const {
+        return iswalpha(*m_current) != 0 || *m_current == L'_';
+    }
+
+    void ScanIdentifier() {
+        const wchar_t *first = m_current;
+        while(IsIdentifierChar(*m_current)) ++m_current;
+        AddToResult(Variable{ std::wstring(first, m_current) });
+    }
+
     const static auto &CharToOperatorMap() {
         static const std::unordered_map<wchar_t, Operator> opmap{
                 { L'+', Operator::Plus }, { L'-', Operator::Minus },
@@ -176,6 +245,11 @@ private:
         m_nextCanBeUnary = false;
     }
 
+    void Visit(const Variable &variable) override {
+        AddToResult(variable);
+        m_nextCanBeUnary = false;
+    }
+
     void Visit(Operator op) override {
         AddToResult(m_nextCanBeUnary ? TryConvertToUnary(op) : op);
         m_nextCanBeUnary = (op != Operator::RParen);
@@ -247,6 +321,10 @@ private:
         AddToResult(num);
     }
 
+    void Visit(const Variable &variable) override {
+        AddToResult(variable);
+    }
+
     bool StackHasNoOperators() const {
         if(m_stack.back() == Operator::LParen) throw std::logic_error("Closing paren not found.");
         return false;
@@ -294,6 +372,8 @@ namespace Detail {
 
 class StackEvaluator : public TokenVisitor {
 public:
+    explicit StackEvaluator(const Bindings &bindings) : m_bindings(bindings) {}
+
     double Result() const {
         return m_stack.empty() ? 0.0 : m_stack.back();
     }
@@ -318,7 +398,8 @@ private:
                 { Operator::Minus, MakeEvaluator(2, [=](Args a) { return a[0] - a[1]; }) },
                 { Operator::Mul, MakeEvaluator(2, [=](Args a) { return a[0] * a[1]; }) },
                 { Operator::Div, MakeEvaluator(2, [=](Args a) { return a[0] / a[1]; }) },
-                { Operator::UMinus, MakeEvaluator(1, [=](Args a) { return -a[0]; }) }
+                { Operator::UMinus, MakeEvaluator(1, [=](Args a) { return -a[0]; }) },
+                { Operator::FusedMulAdd, MakeEvaluator(3, [=](Args a) { return std::fma(a[0], a[1], a[2]); }) }
         };
         evaluators.at(op)(m_stack);
     }
@@ -327,20 +408,27 @@ private:
         m_stack.push_back(num);
     }
 
+    void Visit(const Variable &variable) override {
+        auto value = m_bindings.find(variable.m_name);
+        if(value == m_bindings.end()) throw std::logic_error("Variable is not bound.");
+        m_stack.push_back(value->second);
+    }
+
+    const Bindings &m_bindings;
     OpStack m_stack;
 };
 } // namespace Detail
 
 // Evaluate the sequence of tokens in postfix notation and get a numerical result.
-inline double Evaluate(const Tokens &tokens) {
-    Detail::StackEvaluator evaluator;
+inline double Evaluate(const Tokens &tokens, const Bindings &bindings = {}) {
+    Detail::StackEvaluator evaluator(bindings);
     evaluator.VisitAll(tokens.cbegin(), tokens.cend());
     return evaluator.Result();
 }
 } // namespace Evaluator
 
 // Interpret the mathematical expression in infix notation and return a numerical result.
-inline double InterpreteExperssion(const std::wstring &expression) {
-    return Evaluator::Evaluate(Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression))));
+inline double InterpreteExperssion(const std::wstring &expression, const Bindings &bindings = {}) {
+    return Evaluator::Evaluate(Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression))), bindings);
 }
 } // namespace Interpreter
\ No newline at end of file
@@ -1,36 +1,10 @@
 #include "stdafx.h"
 #include "CppUnitTest.h"
 #include "Interpreter.h"
+#include "TestUtilities.h"
 
 namespace InterpreterTests {
 
-using namespace Microsoft::VisualStudio::CppUnitTestFramework;
-using namespace Interpreter;
-using namespace std;
-
-namespace AssertRange {
-
-template<class T, class ActualRange>
-static void AreEqual(initializer_list<T> expect, const ActualRange &actual) {
-    auto actualIter = begin(actual);
-    auto expectIter = begin(expect);
-
-    Assert::AreEqual(distance(expectIter, end(expect)), distance(actualIter, end(actual)), L"Size differs.");
-
-    for(; expectIter != end(expect) && actualIter != end(actual); ++expectIter, ++actualIter) {
-        auto message = L"Mismatch at position " + to_wstring(distance(begin(expect), expectIter));
-        Assert::AreEqual<T>(*expectIter, *actualIter, message.c_str());
-    }
-}
-
-} // namespace AssertRange
-
-const Token plus(MakeToken(Operator::Plus)), minus(MakeToken(Operator::Minus));
-const Token mul(MakeToken(Operator::Mul)), div(MakeToken(Operator::Div));
-const Token pLeft(MakeToken(Operator::LParen)), pRight(MakeToken(Operator::RParen));
-const Token uPlus(MakeToken(Operator::UPlus)), uMinus(MakeToken(Operator::UMinus));
-const Token _1(MakeToken(1)), _2(MakeToken(2)), _3(MakeToken(3)), _4(MakeToken(4)), _5(MakeToken(5));
-
 TEST_CLASS(LexerTests) {
 public:
     TEST_METHOD(Should_return_empty_token_list_when_put_empty_expression) {
@@ -67,6 +41,11 @@ public:
         Tokens tokens = Lexer::Tokenize(L"1+2*3/(4-5)");
         AssertRange::AreEqual({ _1, plus, _2, mul, _3, div, pLeft, _4, minus, _5, pRight }, tokens);
     }
+
+    TEST_METHOD(Should_tokenize_variables) {
+        Tokens tokens = Lexer::Tokenize(L"a*rate_2");
+        AssertRange::AreEqual({ a, mul, MakeToken(Variable{ L"rate_2" }) }, tokens);
+    }
 };
 
 TEST_CLASS(LexerMarkUnaryOperatorsTests) {
@@ -92,6 +71,11 @@ public:
         AssertRange::AreEqual({ _1, minus, uMinus, _1 }, result);
     }
 
+    TEST_METHOD(Should_not_mark_minus_after_variable) {
+        Tokens result = Lexer::MarkUnaryOperators({ a, minus, _1 });
+        AssertRange::AreEqual({ a, minus, _1 }, result);
+    }
+
     TEST_METHOD(Should_mark_unary_minus_after_plus) {
         Tokens result = Lexer::MarkUnaryOperators({ _1, plus, minus, _1 });
         AssertRange::AreEqual({ _1, plus, uMinus, _1 }, result);
@@ -122,6 +106,12 @@ public:
         Assert::AreNotEqual(_1, _2);
         Assert::AreNotEqual(_1, minus);
     }
+
+    TEST_METHOD(Should_check_for_equality_variable_tokens) {
+        Assert::AreEqual(a, MakeToken(Variable{ L"a" }));
+        Assert::AreNotEqual(a, b);
+        Assert::AreNotEqual(a, _1);
+    }
 };
 
 TEST_CLASS(ParserTests) {
@@ -205,6 +195,11 @@ public:
         Assert::IsTrue(Parser::PrecedenceOf(uMinus) > Parser::PrecedenceOf(plus));
     }
 
+    TEST_METHOD(Should_parse_variables_as_numbers) {
+        Tokens tokens = Parser::Parse({ a, plus, b, mul, _2 });
+        AssertRange::AreEqual({ a, b, _2, mul, plus }, tokens);
+    }
+
     TEST_METHOD(Should_parse_unary_minus_with_greater_precedence) {
         // 3/-1*-2 = 3 1 u- / 2 u- *
         Tokens tokens = Parser::Parse({ _3, div, uMinus, _1, mul, uMinus, _2 });
@@ -254,6 +249,15 @@ public:
         double result = Evaluator::Evaluate({ _1, uMinus });
         Assert::AreEqual(-1.0, result);
     }
+
+    TEST_METHOD(Should_eval_expression_with_bound_variables) {
+        double result = Evaluator::Evaluate({ a, b, minus }, { { L"a", 5 }, { L"b", 2 } });
+        Assert::AreEqual(3.0, result);
+    }
+
+    TEST_METHOD(Should_throw_when_variable_is_not_bound) {
+        Assert::ExpectException<std::logic_error>([]() { Evaluator::Evaluate({ a, _1, plus }); });
+    }
 };
 
 TEST_CLASS(InterpreterIntegrationTests) {
@@ -267,6 +271,11 @@ public:
         double result = Interpreter::InterpreteExperssion(L"1-(2+3/-1*-2)");
         Assert::AreEqual(-7.0, result);
     }
+
+    TEST_METHOD(Should_interprete_experssion_with_variables) {
+        double result = Interpreter::InterpreteExperssion(L"(a+b)*-a", { { L"a", 2 }, { L"b", 3 } });
+        Assert::AreEqual(-10.0, result);
+    }
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,641 @@
+#pragma once
+#include "Ast.h"
+#include <map>
+#include <unordered_set>
+
+namespace Interpreter {
+namespace Optimizer {
+
+enum class Mode {
+    // Only rewrites that give bit-identical results for every input.
+    Strict,
+    // Also rewrites that ignore NaN, infinities and the sign of zero.
+    FastMath,
+};
+
+// Regrouping of long + and * chains, changes rounding so it is never done by default.
+enum class Reassociation {
+    None,
+    // Chain becomes a balanced tree with logarithmic depth.
+    BalancedTree,
+    // Terms are summed round-robin into independent partial results that are combined at the end.
+    Accumulators,
+};
+
+// Fused multiply-add is a single instruction on the target, otherwise std::fma is emulated and slow.
+#if defined(FP_FAST_FMA) || defined(__FMA__) || defined(__AVX2__)
+const bool HardwareFusedMultiplyAdd = true;
+#else
+const bool HardwareFusedMultiplyAdd = false;
+#endif
+
+// Evaluation of sums that are polynomials in one variable, changes rounding so it is never done by default.
+enum class PolynomialScheme {
+    None,
+    // c0 + x*(c1 + x*(c2 + ...)), the fewest operations.
+    Horner,
+    // (c0 + c1*x) + x^2*(c2 + c3*x) + ..., independent parts can run in parallel.
+    Estrin,
+};
+
+struct Options {
+    Mode m_mode = Mode::Strict;
+    Reassociation m_reassociation = Reassociation::None;
+    size_t m_accumulators = 4;
+    PolynomialScheme m_polynomials = PolynomialScheme::None;
+    // Contract a*b+c to fma(a,b,c) in fast-math mode, it rounds once instead of twice.
+    bool m_fuseMultiplyAdd = HardwareFusedMultiplyAdd;
+};
+
+// Number of times each rewrite rule was applied.
+class Statistics {
+public:
+    void Count(const std::wstring &rule) {
+        ++m_counts[rule];
+    }
+
+    size_t CountOf(const std::wstring &rule) const {
+        auto count = m_counts.find(rule);
+        return count == m_counts.end() ? 0 : count->second;
+    }
+
+    size_t Total() const {
+        size_t total = 0;
+        for(const auto &count : m_counts) total += count.second;
+        return total;
+    }
+
+    const std::map<std::wstring, size_t> &Counts() const {
+        return m_counts;
+    }
+
+private:
+    std::map<std::wstring, size_t> m_counts;
+};
+
+namespace Detail {
+
+using Ast::NodePtr;
+
+inline bool AllNumbers(const Ast::Nodes &args) {
+    return std::all_of(args.cbegin(), args.cend(), [](const NodePtr &arg) { return Ast::IsNumber(arg); });
+}
+
+// Evaluate the operator with the evaluator itself, so folded values are exactly what it would produce at run time.
+inline NodePtr Fold(const NodePtr &node, const Ast::Nodes &args) {
+    Tokens tokens;
+    for(const auto &arg : args) tokens.push_back(arg->m_token);
+    tokens.push_back(node->m_token);
+    return Ast::MakeLeaf(Evaluator::Evaluate(tokens));
+}
+
+inline NodePtr FoldConstantNode(const NodePtr &node, Ast::Nodes args) {
+    if(node->m_token == Operator::UPlus) return args.front();
+    if(!args.empty() && AllNumbers(args)) return Fold(node, args);
+    return Ast::Rebuild(node, std::move(args));
+}
+
+inline bool IsLiteral(const NodePtr &node, double value) {
+    const double *num = Ast::NumberOf(node);
+    return num && *num == value && std::signbit(*num) == std::signbit(value);
+}
+
+inline bool IsZero(const NodePtr &node) {
+    const double *num = Ast::NumberOf(node);
+    return num && *num == 0.0;
+}
+
+inline bool IsNegation(const NodePtr &node) {
+    return node->m_token == Operator::UMinus;
+}
+
+// Multiplication by the reciprocal is exactly the same as division for powers of two
+// whose reciprocal is also representable.
+inline bool HasExactReciprocal(const double *num) {
+    int exponent = 0;
+    return num && std::isfinite(*num) && std::fabs(std::frexp(*num, &exponent)) == 0.5 && std::isfinite(1.0 / *num);
+}
+
+inline NodePtr MakeOperation(Operator op, Ast::Nodes args) {
+    return Ast::MakeNode(MakeToken(op), std::move(args));
+}
+
+inline NodePtr Negate(const NodePtr &node) {
+    return MakeOperation(Operator::UMinus, { node });
+}
+
+// The other argument of the commutative operator when one of them is the literal.
+inline NodePtr OtherThanLiteral(const NodePtr &node, double value) {
+    if(IsLiteral(node->m_args[1], value)) return node->m_args[0];
+    if(IsLiteral(node->m_args[0], value)) return node->m_args[1];
+    return nullptr;
+}
+
+struct Rule {
+    const wchar_t *m_name;
+    Operator m_op;
+    Mode m_mode;
+    NodePtr (*m_apply)(const NodePtr &);
+};
+
+// Each rule returns the replacement for the node or nullptr when it doesn't match.
+inline const std::vector<Rule> &Rules() {
+    static const std::vector<Rule> rules{
+            { L"x*1", Operator::Mul, Mode::Strict, [](const NodePtr &n) { return OtherThanLiteral(n, 1.0); } },
+            { L"x*-1", Operator::Mul, Mode::Strict, [](const NodePtr &n) {
+                NodePtr other = OtherThanLiteral(n, -1.0);
+                return other ? Negate(other) : nullptr;
+            } },
+            { L"x/1", Operator::Div, Mode::Strict, [](const NodePtr &n) {
+                return IsLiteral(n->m_args[1], 1.0) ? n->m_args[0] : nullptr;
+            } },
+            { L"x/-1", Operator::Div, Mode::Strict, [](const NodePtr &n) {
+                return IsLiteral(n->m_args[1], -1.0) ? Negate(n->m_args[0]) : nullptr;
+            } },
+            { L"x+-0", Operator::Plus, Mode::Strict, [](const NodePtr &n) { return OtherThanLiteral(n, -0.0); } },
+            { L"x-0", Operator::Minus, Mode::Strict, [](const NodePtr &n) {
+                return IsLiteral(n->m_args[1], 0.0) ? n->m_args[0] : nullptr;
+            } },
+            { L"--x", Operator::UMinus, Mode::Strict, [](const NodePtr &n) {
+                return IsNegation(n->m_args[0]) ? n->m_args[0]->m_args[0] : nullptr;
+            } },
+            { L"x+-y", Operator::Plus, Mode::Strict, [](const NodePtr &n) {
+                if(IsNegation(n->m_args[1])) return MakeOperation(Operator::Minus, { n->m_args[0], n->m_args[1]->m_args[0] });
+                if(IsNegation(n->m_args[0])) return MakeOperation(Operator::Minus, { n->m_args[1], n->m_args[0]->m_args[0] });
+                return NodePtr();
+            } },
+            { L"x--y", Operator::Minus, Mode::Strict, [](const NodePtr &n) {
+                if(!IsNegation(n->m_args[1])) return NodePtr();
+                return MakeOperation(Operator::Plus, { n->m_args[0], n->m_args[1]->m_args[0] });
+            } },
+            { L"-x*-y", Operator::Mul, Mode::Strict, [](const NodePtr &n) {
+                if(!IsNegation(n->m_args[0]) || !IsNegation(n->m_args[1])) return NodePtr();
+                return MakeOperation(Operator::Mul, { n->m_args[0]->m_args[0], n->m_args[1]->m_args[0] });
+            } },
+            { L"-x/-y", Operator::Div, Mode::Strict, [](const NodePtr &n) {
+                if(!IsNegation(n->m_args[0]) || !IsNegation(n->m_args[1])) return NodePtr();
+                return MakeOperation(Operator::Div, { n->m_args[0]->m_args[0], n->m_args[1]->m_args[0] });
+            } },
+            { L"x/2^k", Operator::Div, Mode::Strict, [](const NodePtr &n) {
+                const double *num = Ast::NumberOf(n->m_args[1]);
+                if(!HasExactReciprocal(num)) return NodePtr();
+                return MakeOperation(Operator::Mul, { n->m_args[0], Ast::MakeLeaf(1.0 / *num) });
+            } },
+            { L"x/c", Operator::Div, Mode::FastMath, [](const NodePtr &n) {
+                const double *num = Ast::NumberOf(n->m_args[1]);
+                if(!num || *num == 0.0 || !std::isfinite(*num)) return NodePtr();
+                return MakeOperation(Operator::Mul, { n->m_args[0], Ast::MakeLeaf(1.0 / *num) });
+            } },
+            { L"x+0", Operator::Plus, Mode::FastMath, [](const NodePtr &n) {
+                if(IsZero(n->m_args[1])) return n->m_args[0];
+                if(IsZero(n->m_args[0])) return n->m_args[1];
+                return NodePtr();
+            } },
+            { L"0-x", Operator::Minus, Mode::FastMath, [](const NodePtr &n) {
+                return IsZero(n->m_args[0]) ? Negate(n->m_args[1]) : nullptr;
+            } },
+            { L"0*x", Operator::Mul, Mode::FastMath, [](const NodePtr &n) {
+                return IsZero(n->m_args[0]) || IsZero(n->m_args[1]) ? Ast::MakeLeaf(0.0) : nullptr;
+            } },
+            { L"0/x", Operator::Div, Mode::FastMath, [](const NodePtr &n) {
+                return IsZero(n->m_args[0]) ? Ast::MakeLeaf(0.0) : nullptr;
+            } },
+            { L"x-x", Operator::Minus, Mode::FastMath, [](const NodePtr &n) {
+                return Ast::Equal(n->m_args[0], n->m_args[1]) ? Ast::MakeLeaf(0.0) : nullptr;
+            } },
+            { L"x/x", Operator::Div, Mode::FastMath, [](const NodePtr &n) {
+                return Ast::Equal(n->m_args[0], n->m_args[1]) ? Ast::MakeLeaf(1.0) : nullptr;
+            } },
+    };
+    return rules;
+}
+
+class Simplifier {
+public:
+    Simplifier(const Options &options, Statistics *statistics) : m_options(options), m_statistics(statistics) {}
+
+    NodePtr operator()(const NodePtr &node, Ast::Nodes args) {
+        NodePtr result = FoldConstantNode(node, std::move(args));
+        if(result != node && !node->m_args.empty() && Ast::IsNumber(result)) Count(L"fold");
+        while(NodePtr rewritten = ApplyFirstMatchingRule(result)) {
+            result = rewritten;
+            if(!result->m_args.empty() && AllNumbers(result->m_args)) result = Fold(result, result->m_args);
+        }
+        return result;
+    }
+
+private:
+    NodePtr ApplyFirstMatchingRule(const NodePtr &node) {
+        for(const auto &rule : Rules()) {
+            if(!IsEnabled(rule) || !(node->m_token == rule.m_op)) continue;
+            if(NodePtr rewritten = rule.m_apply(node)) {
+                Count(rule.m_name);
+                return rewritten;
+            }
+        }
+        return nullptr;
+    }
+
+    bool IsEnabled(const Rule &rule) const {
+        return rule.m_mode == Mode::Strict || m_options.m_mode == Mode::FastMath;
+    }
+
+    void Count(const wchar_t *rule) {
+        if(m_statistics) m_statistics->Count(rule);
+    }
+
+    const Options &m_options;
+    Statistics *m_statistics;
+};
+
+typedef std::unordered_map<const Ast::Node *, bool> Interiors;
+
+inline bool IsAdditive(const NodePtr &node) {
+    return node->m_token == Operator::Plus || node->m_token == Operator::Minus;
+}
+
+// Interior nodes of a chain are handled together with the root of the chain,
+// a node that is also used outside of the chain is a root itself.
+template<typename F> Interiors FindChainInteriors(const NodePtr &root, F sameChain) {
+    Interiors interiors;
+    if(!root) return interiors;
+    interiors[root.get()] = false;
+    std::vector<const NodePtr *> pending{ &root };
+    while(!pending.empty()) {
+        const NodePtr &node = *pending.back();
+        pending.pop_back();
+        for(const auto &arg : node->m_args) {
+            const bool interior = sameChain(node, arg);
+            auto found = interiors.emplace(arg.get(), interior);
+            if(!found.second) {
+                found.first->second = found.first->second && interior;
+                continue;
+            }
+            pending.push_back(&arg);
+        }
+    }
+    return interiors;
+}
+
+// Argument of a chain of the same associative operation, inverted terms are subtracted.
+struct Term {
+    NodePtr m_node;
+    bool m_inverted;
+};
+
+typedef std::vector<Term> Terms;
+
+class Reassociator {
+public:
+    Reassociator(const NodePtr &root, const Options &options, Statistics *statistics)
+            : m_options(options), m_statistics(statistics), m_interior(FindChainInteriors(root, SameChain)) {}
+
+    NodePtr operator()(const NodePtr &node, Ast::Nodes args) {
+        NodePtr result = Ast::Rebuild(node, std::move(args));
+        if(!IsChain(node)) return result;
+        if(m_interior[node.get()]) {
+            m_rebuiltInteriors.insert(result.get());
+            return result;
+        }
+        const Operator op = IsAdditive(node) ? Operator::Plus : Operator::Mul;
+        Terms terms = Flatten(result);
+        if(terms.size() < 3) return result;
+        if(m_statistics) m_statistics->Count(L"reassociate");
+        GroupConstants(op, terms);
+        if(m_options.m_reassociation == Reassociation::Accumulators) return Accumulate(op, terms);
+        return Balance(op, terms.cbegin(), terms.cend());
+    }
+
+private:
+    static bool IsChain(const NodePtr &node) {
+        return IsAdditive(node) || node->m_token == Operator::Mul;
+    }
+
+    static bool SameChain(const NodePtr &parent, const NodePtr &child) {
+        return IsAdditive(parent) ? IsAdditive(child) : parent->m_token == Operator::Mul && child->m_token == Operator::Mul;
+    }
+
+    Terms Flatten(const NodePtr &root) {
+        Terms terms;
+        std::vector<Term> pending{ { root, false } };
+        while(!pending.empty()) {
+            Term term = pending.back();
+            pending.pop_back();
+            const NodePtr &node = term.m_node;
+            if(node != root && (!SameChain(root, node) || !m_rebuiltInteriors.count(node.get()))) {
+                terms.push_back(term);
+                continue;
+            }
+            pending.push_back({ node->m_args[1], term.m_inverted != (node->m_token == Operator::Minus) });
+            pending.push_back({ node->m_args[0], term.m_inverted });
+        }
+        return terms;
+    }
+
+    // Literals are combined into one in the order they appear and put at the end of the chain.
+    void GroupConstants(Operator op, Terms &terms) {
+        auto constants = std::stable_partition(terms.begin(), terms.end(), [](const Term &term) { return !Ast::IsNumber(term.m_node); });
+        if(terms.end() - constants < 2) return;
+        NodePtr folded = Combine(op, Terms(constants, terms.end()));
+        terms.erase(constants, terms.end());
+        terms.push_back({ Ast::Transform(folded, FoldConstantNode), false });
+        if(m_statistics) m_statistics->Count(L"group constants");
+    }
+
+    static NodePtr Start(const Term &term) {
+        return term.m_inverted ? Negate(term.m_node) : term.m_node;
+    }
+
+    // Left to right combination of the terms.
+    static NodePtr Combine(Operator op, const Terms &terms) {
+        NodePtr result = Start(terms.front());
+        for(auto term = terms.cbegin() + 1; term != terms.cend(); ++term) {
+            result = MakeOperation(term->m_inverted ? Operator::Minus : op, { result, term->m_node });
+        }
+        return result;
+    }
+
+    static NodePtr Balance(Operator op, Terms::const_iterator first, Terms::const_iterator last) {
+        if(last - first == 1) return Start(*first);
+        auto middle = first + (last - first) / 2;
+        NodePtr left = Balance(op, first, middle);
+        if(!middle->m_inverted) return MakeOperation(op, { left, Balance(op, middle, last) });
+        Terms flipped(middle, last);
+        for(auto &term : flipped) term.m_inverted = !term.m_inverted;
+        return MakeOperation(Operator::Minus, { left, Balance(op, flipped.cbegin(), flipped.cend()) });
+    }
+
+    NodePtr Accumulate(Operator op, const Terms &terms) const {
+        const size_t count = std::max<size_t>(1, std::min(m_options.m_accumulators, terms.size()));
+        Terms partials;
+        for(size_t i = 0; i < count; ++i) {
+            Terms group;
+            for(size_t j = i; j < terms.size(); j += count) group.push_back(terms[j]);
+            partials.push_back({ Combine(op, group), false });
+        }
+        return Balance(op, partials.cbegin(), partials.cend());
+    }
+
+    const Options &m_options;
+    Statistics *m_statistics;
+    Interiors m_interior;
+    std::unordered_set<const Ast::Node *> m_rebuiltInteriors;
+};
+
+// Coefficients by degree, nullptr for zero. Empty when the subtree is not a polynomial.
+typedef Ast::Nodes Coefficients;
+
+class PolynomialRewriter {
+public:
+    PolynomialRewriter(const NodePtr &root, const Options &options, Statistics *statistics)
+            : m_options(options), m_statistics(statistics), m_interior(FindChainInteriors(root, BothAdditive)) {}
+
+    NodePtr operator()(const NodePtr &node, Ast::Nodes args) {
+        NodePtr result = Ast::Rebuild(node, std::move(args));
+        if(!IsAdditive(node) || m_interior[node.get()]) return result;
+        NodePtr best = node;
+        size_t bestSize = Ast::CountNodes(node);
+        for(const auto &variable : RepeatedFactorsOf(node)) {
+            const Coefficients &coefficients = Convert(node, variable);
+            if(coefficients.size() < 3) continue;
+            NodePtr candidate = Simplify(Emit(coefficients, Ast::MakeLeaf(variable)));
+            const size_t size = Ast::CountNodes(candidate);
+            if(size < bestSize) {
+                best = candidate;
+                bestSize = size;
+            }
+        }
+        if(best == node) return result;
+        if(m_statistics) m_statistics->Count(m_options.m_polynomials == PolynomialScheme::Estrin ? L"estrin" : L"horner");
+        return best;
+    }
+
+private:
+    static const size_t MaxDegree = 32;
+
+    static bool BothAdditive(const NodePtr &parent, const NodePtr &child) {
+        return IsAdditive(parent) && IsAdditive(child);
+    }
+
+    // Variables that are a factor of some product more than once, only they can have degree 2 or higher
+    // in the expanded form. This keeps the search linear for long sums of many variables.
+    static std::vector<Variable> RepeatedFactorsOf(const NodePtr &root) {
+        std::vector<Variable> repeated;
+        std::unordered_map<const Ast::Node *, std::vector<Variable>> factors;
+        Ast::Transform(root, [&repeated, &factors](const NodePtr &node, Ast::Nodes) {
+            if(!(node->m_token == Operator::Mul)) return node;
+            auto &own = factors[node.get()];
+            for(const auto &arg : node->m_args) {
+                if(const Variable *variable = Ast::VariableOf(arg)) own.push_back(*variable);
+                auto nested = factors.find(arg.get());
+                if(nested != factors.end()) own.insert(own.end(), nested->second.cbegin(), nested->second.cend());
+            }
+            for(auto factor = own.cbegin(); factor != own.cend(); ++factor) {
+                if(std::find(own.cbegin(), factor, *factor) != factor && std::find(repeated.cbegin(), repeated.cend(), *factor) == repeated.cend()) {
+                    repeated.push_back(*factor);
+                }
+            }
+            return node;
+        });
+        return repeated;
+    }
+
+    // Coefficients of the original subtree, remembered per variable so nested sums are converted once.
+    const Coefficients &Convert(const NodePtr &root, const Variable &variable) {
+        auto &converted = m_converted[variable.m_name];
+        Ast::Transform(root, [&converted, &variable](const NodePtr &node, Ast::Nodes) {
+            if(!converted.count(node.get())) converted[node.get()] = ConvertNode(node, variable, converted);
+            return node;
+        });
+        return converted.at(root.get());
+    }
+
+    static Coefficients ConvertNode(const NodePtr &node, const Variable &variable, const std::unordered_map<const Ast::Node *, Coefficients> &converted) {
+        if(const Variable *leaf = Ast::VariableOf(node)) {
+            if(*leaf == variable) return { nullptr, Ast::MakeLeaf(1.0) };
+        }
+        std::vector<const Coefficients *> args;
+        bool constant = true;
+        for(const auto &arg : node->m_args) {
+            args.push_back(&converted.at(arg.get()));
+            if(args.back()->empty()) return {};
+            constant = constant && args.back()->size() == 1;
+        }
+        if(constant) return { node };
+        if(node->m_token == Operator::Plus) return Add(*args[0], *args[1]);
+        if(node->m_token == Operator::Minus) return Add(*args[0], Negate(*args[1]));
+        if(node->m_token == Operator::UMinus) return Negate(*args[0]);
+        if(node->m_token == Operator::Mul) return Multiply(*args[0], *args[1]);
+        if(node->m_token == Operator::FusedMulAdd) return Add(Multiply(*args[0], *args[1]), *args[2]);
+        if(node->m_token == Operator::Div && args[1]->size() == 1) return Divide(*args[0], args[1]->front());
+        return {};
+    }
+
+    static NodePtr AddCoefficients(const NodePtr &left, const NodePtr &right) {
+        if(!left) return right;
+        if(!right) return left;
+        return MakeOperation(Operator::Plus, { left, right });
+    }
+
+    static NodePtr MultiplyCoefficients(const NodePtr &left, const NodePtr &right) {
+        if(!left || !right) return nullptr;
+        if(IsLiteral(left, 1.0)) return right;
+        if(IsLiteral(right, 1.0)) return left;
+        return MakeOperation(Operator::Mul, { left, right });
+    }
+
+    static Coefficients Add(const Coefficients &left, const Coefficients &right) {
+        Coefficients result(std::max(left.size(), right.size()));
+        for(size_t i = 0; i < result.size(); ++i) {
+            result[i] = AddCoefficients(i < left.size() ? left[i] : nullptr, i < right.size() ? right[i] : nullptr);
+        }
+        return result;
+    }
+
+    static Coefficients Negate(const Coefficients &coefficients) {
+        Coefficients result;
+        for(const auto &coefficient : coefficients) result.push_back(coefficient ? Detail::Negate(coefficient) : nullptr);
+        return result;
+    }
+
+    static Coefficients Multiply(const Coefficients &left, const Coefficients &right) {
+        if(left.size() + right.size() - 1 > MaxDegree + 1) return {};
+        Coefficients result(left.size() + right.size() - 1);
+        for(size_t i = 0; i < left.size(); ++i) {
+            for(size_t j = 0; j < right.size(); ++j) {
+                result[i + j] = AddCoefficients(result[i + j], MultiplyCoefficients(left[i], right[j]));
+            }
+        }
+        return result;
+    }
+
+    static Coefficients Divide(const Coefficients &coefficients, const NodePtr &divisor) {
+        Coefficients result;
+        for(const auto &coefficient : coefficients) {
+            result.push_back(coefficient ? MakeOperation(Operator::Div, { coefficient, divisor }) : nullptr);
+        }
+        return result;
+    }
+
+    NodePtr Simplify(const NodePtr &root) const {
+        return Ast::Transform(root, Simplifier(m_options, nullptr));
+    }
+
+    NodePtr Emit(const Coefficients &coefficients, const NodePtr &variable) const {
+        if(m_options.m_polynomials == PolynomialScheme::Estrin) {
+            Ast::Nodes powers{ variable };
+            while((size_t(1) << powers.size()) < coefficients.size()) powers.push_back(MakeOperation(Operator::Mul, { powers.back(), powers.back() }));
+            return Estrin(coefficients.cbegin(), coefficients.cend(), powers);
+        }
+        NodePtr result = coefficients.back();
+        for(auto coefficient = coefficients.crbegin() + 1; coefficient != coefficients.crend(); ++coefficient) {
+            result = AddCoefficients(MultiplyCoefficients(result, variable), *coefficient);
+        }
+        return result;
+    }
+
+    // Lower half plus upper half multiplied by x to the power of the half size, powers[k] is x^(2^k).
+    static NodePtr Estrin(Coefficients::const_iterator first, Coefficients::const_iterator last, const Ast::Nodes &powers) {
+        if(last - first == 1) return *first;
+        size_t half = 1;
+        while(half * 2 < size_t(last - first)) half *= 2;
+        NodePtr low = Estrin(first, first + half, powers);
+        NodePtr high = Estrin(first + half, last, powers);
+        return AddCoefficients(low, MultiplyCoefficients(high, powers[Log2(half)]));
+    }
+
+    static size_t Log2(size_t value) {
+        size_t log = 0;
+        while(value >>= 1) ++log;
+        return log;
+    }
+
+    const Options &m_options;
+    Statistics *m_statistics;
+    Interiors m_interior;
+    std::unordered_map<std::wstring, std::unordered_map<const Ast::Node *, Coefficients>> m_converted;
+};
+
+inline bool IsMultiplication(const NodePtr &node) {
+    return node->m_token == Operator::Mul;
+}
+
+class MultiplyAddFuser {
+public:
+    explicit MultiplyAddFuser(Statistics *statistics) : m_statistics(statistics) {}
+
+    NodePtr operator()(const NodePtr &node, Ast::Nodes args) {
+        NodePtr result = Ast::Rebuild(node, std::move(args));
+        if(result->m_token == Operator::Plus) {
+            if(IsMultiplication(result->m_args[0])) return Fuse(result->m_args[0], result->m_args[1]);
+            if(IsMultiplication(result->m_args[1])) return Fuse(result->m_args[1], result->m_args[0]);
+        }
+        else if(result->m_token == Operator::Minus) {
+            if(IsMultiplication(result->m_args[0])) return Fuse(result->m_args[0], Negate(result->m_args[1]));
+            if(IsMultiplication(result->m_args[1])) {
+                const NodePtr &product = result->m_args[1];
+                return Fuse(MakeOperation(Operator::Mul, { Negate(product->m_args[0]), product->m_args[1] }), result->m_args[0]);
+            }
+        }
+        return result;
+    }
+
+private:
+    NodePtr Fuse(const NodePtr &product, const NodePtr &addend) {
+        if(m_statistics) m_statistics->Count(L"fma");
+        return MakeOperation(Operator::FusedMulAdd, { product->m_args[0], product->m_args[1], addend });
+    }
+
+    Statistics *m_statistics;
+};
+} // namespace Detail
+
+// Replace every subtree that depends only on literals with a single literal.
+inline Ast::NodePtr FoldConstants(const Ast::NodePtr &root) {
+    return Ast::Transform(root, Detail::FoldConstantNode);
+}
+
+// Fold constants in the sequence of tokens in postfix notation.
+inline Tokens FoldConstants(const Tokens &tokens) {
+    return Ast::ToPostfix(FoldConstants(Ast::Build(tokens)));
+}
+
+// Fold constants and apply algebraic identities allowed in the mode, like x*1 = x or --x = x.
+inline Ast::NodePtr Simplify(const Ast::NodePtr &root, const Options &options = {}, Statistics *statistics = nullptr) {
+    return Ast::Transform(root, Detail::Simplifier(options, statistics));
+}
+
+// Regroup chains of additions and subtractions or multiplications as selected in the options.
+inline Ast::NodePtr Reassociate(const Ast::NodePtr &root, const Options &options, Statistics *statistics = nullptr) {
+    if(options.m_reassociation == Reassociation::None) return root;
+    return Ast::Transform(root, Detail::Reassociator(root, options, statistics));
+}
+
+// Evaluate sums that are polynomials in one variable with the scheme selected in the options,
+// when it takes fewer operations.
+inline Ast::NodePtr RewritePolynomials(const Ast::NodePtr &root, const Options &options, Statistics *statistics = nullptr) {
+    if(options.m_polynomials == PolynomialScheme::None) return root;
+    return Ast::Transform(root, Detail::PolynomialRewriter(root, options, statistics));
+}
+
+// Contract multiplications followed by addition or subtraction to fused multiply-add.
+inline Ast::NodePtr FuseMultiplyAdd(const Ast::NodePtr &root, Statistics *statistics = nullptr) {
+    return Ast::Transform(root, Detail::MultiplyAddFuser(statistics));
+}
+
+// Run all optimization passes enabled in the options.
+inline Ast::NodePtr Optimize(const Ast::NodePtr &root, const Options &options = {}, Statistics *statistics = nullptr) {
+    Ast::NodePtr result = Simplify(root, options, statistics);
+    if(options.m_reassociation != Reassociation::None) {
+        result = Simplify(Reassociate(result, options, statistics), options, statistics);
+    }
+    if(options.m_polynomials != PolynomialScheme::None) {
+        result = RewritePolynomials(result, options, statistics);
+    }
+    if(options.m_mode == Mode::FastMath && options.m_fuseMultiplyAdd) {
+        result = FuseMultiplyAdd(result, statistics);
+    }
+    return result;
+}
+} // namespace Optimizer
+} // namespace Interpreter
@@ -0,0 +1,331 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Optimizer.h"
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(ConstantFoldingTests) {
+public:
+    TEST_METHOD(Should_return_empty_list_when_fold_empty_list) {
+        Tokens tokens = Optimizer::FoldConstants(Tokens{});
+        Assert::IsTrue(tokens.empty());
+    }
+
+    TEST_METHOD(Should_fold_multiplication_of_literals) {
+        Tokens tokens = Optimizer::FoldConstants({ _2, _3, mul });
+        AssertRange::AreEqual({ MakeToken(6) }, tokens);
+    }
+
+    TEST_METHOD(Should_fold_unary_minus_on_literal) {
+        Tokens tokens = Optimizer::FoldConstants({ _2, uMinus });
+        AssertRange::AreEqual({ MakeToken(-2) }, tokens);
+    }
+
+    TEST_METHOD(Should_eliminate_unary_plus) {
+        Tokens tokens = Optimizer::FoldConstants({ _2, uPlus, _3, plus });
+        AssertRange::AreEqual({ _5 }, tokens);
+    }
+
+    TEST_METHOD(Should_fold_complex_expression_to_evaluated_value) {
+        // 1-(2+3/-1*-2) = 1 2 3 1 u- / 2 u- * + -
+        Tokens tokens = Optimizer::FoldConstants({ _1, _2, _3, _1, uMinus, div, _2, uMinus, mul, plus, minus });
+        AssertRange::AreEqual({ MakeToken(-7) }, tokens);
+    }
+
+    TEST_METHOD(Should_keep_sign_of_zero_and_infinity) {
+        // 1/-0 = -inf
+        Tokens tokens = Optimizer::FoldConstants({ _1, MakeToken(0), uMinus, div });
+        Assert::AreEqual(size_t(1), tokens.size());
+        Assert::IsTrue(std::isinf(*PayloadOf<double>(tokens.front())));
+        Assert::IsTrue(std::signbit(*PayloadOf<double>(tokens.front())));
+    }
+};
+
+TEST_CLASS(SimplificationTests) {
+public:
+    static Tokens Simplify(const Tokens &tokens, Optimizer::Mode mode, Optimizer::Statistics *statistics = nullptr) {
+        Optimizer::Options options;
+        options.m_mode = mode;
+        return Ast::ToPostfix(Optimizer::Simplify(Ast::Build(tokens), options, statistics));
+    }
+
+    TEST_METHOD(Should_remove_multiplication_and_division_by_one) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Simplify({ _1, x, mul, _1, div }, Optimizer::Mode::Strict, &statistics);
+        AssertRange::AreEqual({ x }, tokens);
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"x*1"));
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"x/1"));
+    }
+
+    TEST_METHOD(Should_remove_double_negation) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Simplify({ x, uMinus, uMinus }, Optimizer::Mode::Strict, &statistics);
+        AssertRange::AreEqual({ x }, tokens);
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"--x"));
+    }
+
+    TEST_METHOD(Should_turn_addition_of_negation_to_subtraction) {
+        Tokens tokens = Simplify({ a, b, uMinus, plus }, Optimizer::Mode::Strict);
+        AssertRange::AreEqual({ a, b, minus }, tokens);
+    }
+
+    TEST_METHOD(Should_keep_addition_of_zero_in_strict_mode) {
+        // -0 + 0 is +0, so x+0 is not x
+        Optimizer::Statistics statistics;
+        Tokens tokens = Simplify({ x, MakeToken(0), plus }, Optimizer::Mode::Strict, &statistics);
+        AssertRange::AreEqual({ x, MakeToken(0), plus }, tokens);
+        Assert::AreEqual(size_t(0), statistics.Total());
+    }
+
+    TEST_METHOD(Should_remove_subtraction_of_zero_in_strict_mode) {
+        Tokens tokens = Simplify({ x, MakeToken(0), minus }, Optimizer::Mode::Strict);
+        AssertRange::AreEqual({ x }, tokens);
+    }
+
+    TEST_METHOD(Should_keep_multiplication_by_zero_in_strict_mode) {
+        Tokens tokens = Simplify({ MakeToken(0), x, mul }, Optimizer::Mode::Strict);
+        AssertRange::AreEqual({ MakeToken(0), x, mul }, tokens);
+    }
+
+    TEST_METHOD(Should_remove_addition_of_zero_and_multiplication_by_zero_in_fast_math_mode) {
+        // 0*a + x + 0
+        Optimizer::Statistics statistics;
+        Tokens tokens = Simplify({ MakeToken(0), a, mul, x, plus, MakeToken(0), plus }, Optimizer::Mode::FastMath, &statistics);
+        AssertRange::AreEqual({ x }, tokens);
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"0*x"));
+        Assert::AreEqual(size_t(2), statistics.CountOf(L"x+0"));
+    }
+
+    TEST_METHOD(Should_cancel_equal_subtrees_in_fast_math_mode) {
+        // (a+b)/(a+b) - 1
+        Tokens tokens = Simplify({ a, b, plus, a, b, plus, div, _1, minus }, Optimizer::Mode::FastMath);
+        AssertRange::AreEqual({ MakeToken(0) }, tokens);
+    }
+
+    TEST_METHOD(Should_fold_constants_produced_by_rewrites) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Simplify({ x, MakeToken(0), mul, _2, plus }, Optimizer::Mode::FastMath, &statistics);
+        AssertRange::AreEqual({ _2 }, tokens);
+    }
+
+    TEST_METHOD(Should_give_same_results_in_strict_mode) {
+        // -(-x*1) / -(a/-1) - -0 for signed zeros, infinities and NaN
+        Tokens tokens{ x, uMinus, _1, mul, uMinus, a, MakeToken(-1), div, uMinus, div, MakeToken(0), uMinus, minus };
+        Tokens simplified = Simplify(tokens, Optimizer::Mode::Strict);
+        Assert::IsTrue(simplified.size() < tokens.size());
+        for(double value : { 0.0, -0.0, 1.5, -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::quiet_NaN() }) {
+            Bindings bindings{ { L"x", value }, { L"a", -value } };
+            double expected = Evaluator::Evaluate(tokens, bindings), actual = Evaluator::Evaluate(simplified, bindings);
+            if(std::isnan(expected)) {
+                Assert::IsTrue(std::isnan(actual));
+                continue;
+            }
+            Assert::AreEqual(expected, actual);
+            Assert::AreEqual(std::signbit(expected), std::signbit(actual));
+        }
+    }
+};
+
+TEST_CLASS(ReassociationTests) {
+public:
+    static size_t DepthOf(const Ast::NodePtr &node) {
+        size_t depth = 0;
+        for(const auto &arg : node->m_args) depth = std::max(depth, DepthOf(arg));
+        return depth + 1;
+    }
+
+    static Tokens SumOf(size_t count, const Token &op = plus) {
+        Tokens tokens{ MakeToken(Variable{ L"v0" }) };
+        for(size_t i = 1; i < count; ++i) {
+            tokens.push_back(MakeToken(Variable{ L"v" + to_wstring(i) }));
+            tokens.push_back(op);
+        }
+        return tokens;
+    }
+
+    static Bindings BindingsFor(size_t count) {
+        Bindings bindings;
+        for(size_t i = 0; i < count; ++i) bindings[L"v" + to_wstring(i)] = double(i + 1);
+        return bindings;
+    }
+
+    static Ast::NodePtr Reassociate(const Tokens &tokens, Optimizer::Reassociation reassociation, size_t accumulators = 4) {
+        Optimizer::Options options;
+        options.m_reassociation = reassociation;
+        options.m_accumulators = accumulators;
+        return Optimizer::Optimize(Ast::Build(tokens), options);
+    }
+
+    TEST_METHOD(Should_not_reassociate_by_default) {
+        Ast::NodePtr root = Optimizer::Optimize(Ast::Build(SumOf(8)));
+        Assert::AreEqual(size_t(8), DepthOf(root));
+    }
+
+    TEST_METHOD(Should_balance_long_sum) {
+        Tokens tokens = SumOf(1024);
+        Optimizer::Statistics statistics;
+        Optimizer::Options options;
+        options.m_reassociation = Optimizer::Reassociation::BalancedTree;
+        Ast::NodePtr root = Optimizer::Optimize(Ast::Build(tokens), options, &statistics);
+        Assert::AreEqual(size_t(11), DepthOf(root));
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"reassociate"));
+        Assert::AreEqual(Evaluator::Evaluate(tokens, BindingsFor(1024)), Evaluator::Evaluate(Ast::ToPostfix(root), BindingsFor(1024)));
+    }
+
+    TEST_METHOD(Should_balance_long_product) {
+        Tokens tokens = SumOf(16, mul);
+        Ast::NodePtr root = Reassociate(tokens, Optimizer::Reassociation::BalancedTree);
+        Assert::AreEqual(size_t(5), DepthOf(root));
+        Assert::AreEqual(Evaluator::Evaluate(tokens, BindingsFor(16)), Evaluator::Evaluate(Ast::ToPostfix(root), BindingsFor(16)));
+    }
+
+    TEST_METHOD(Should_keep_signs_of_subtracted_terms) {
+        Tokens tokens = Postfix(L"v0 - v1 + v2 - (v3 - v4) - v5 - v6 + v7");
+        Ast::NodePtr root = Reassociate(tokens, Optimizer::Reassociation::BalancedTree);
+        Assert::AreEqual(size_t(4), DepthOf(root));
+        Assert::AreEqual(Evaluator::Evaluate(tokens, BindingsFor(8)), Evaluator::Evaluate(Ast::ToPostfix(root), BindingsFor(8)));
+    }
+
+    TEST_METHOD(Should_sum_terms_round_robin_into_accumulators) {
+        Ast::NodePtr root = Reassociate(SumOf(6), Optimizer::Reassociation::Accumulators, 2);
+        Tokens expected = Postfix(L"(v0 + v2 + v4) + (v1 + v3 + v5)");
+        Assert::IsTrue(Ast::Equal(Ast::Build(expected), root));
+    }
+
+    TEST_METHOD(Should_group_literals_of_chain) {
+        // 1 + x + 2 + a + 3 = x + (a + 6)
+        Ast::NodePtr root = Reassociate({ _1, x, plus, _2, plus, a, plus, _3, plus }, Optimizer::Reassociation::BalancedTree);
+        AssertRange::AreEqual({ x, a, MakeToken(6), plus, plus }, Ast::ToPostfix(root));
+    }
+};
+
+TEST_CLASS(StrengthReductionTests) {
+public:
+    static Tokens Optimize(const Tokens &tokens, Optimizer::Mode mode, Optimizer::Statistics *statistics = nullptr) {
+        Optimizer::Options options;
+        options.m_mode = mode;
+        options.m_fuseMultiplyAdd = true;
+        return Ast::ToPostfix(Optimizer::Optimize(Ast::Build(tokens), options, statistics));
+    }
+
+    TEST_METHOD(Should_multiply_by_reciprocal_of_power_of_two_in_strict_mode) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Optimize({ x, _4, div }, Optimizer::Mode::Strict, &statistics);
+        AssertRange::AreEqual({ x, MakeToken(0.25), mul }, tokens);
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"x/2^k"));
+    }
+
+    TEST_METHOD(Should_keep_division_by_power_of_two_without_representable_reciprocal) {
+        Tokens tokens{ x, MakeToken(std::numeric_limits<double>::denorm_min()), div };
+        AssertRange::AreEqual({ tokens[0], tokens[1], tokens[2] }, Optimize(tokens, Optimizer::Mode::Strict));
+    }
+
+    TEST_METHOD(Should_divide_by_other_constants_in_strict_mode) {
+        Tokens tokens = Optimize({ x, _3, div }, Optimizer::Mode::Strict);
+        AssertRange::AreEqual({ x, _3, div }, tokens);
+    }
+
+    TEST_METHOD(Should_multiply_by_reciprocal_of_any_constant_in_fast_math_mode) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Optimize({ x, _3, div }, Optimizer::Mode::FastMath, &statistics);
+        AssertRange::AreEqual({ x, MakeToken(1.0 / 3), mul }, tokens);
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"x/c"));
+    }
+
+    TEST_METHOD(Should_fuse_multiply_add_in_fast_math_mode) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Optimize({ x, a, b, mul, plus }, Optimizer::Mode::FastMath, &statistics);
+        AssertRange::AreEqual({ a, b, x, MakeToken(Operator::FusedMulAdd) }, tokens);
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"fma"));
+    }
+
+    TEST_METHOD(Should_fuse_multiply_subtract_in_fast_math_mode) {
+        Tokens tokens = Optimize({ a, b, mul, x, minus }, Optimizer::Mode::FastMath);
+        AssertRange::AreEqual({ a, b, x, uMinus, MakeToken(Operator::FusedMulAdd) }, tokens);
+    }
+
+    TEST_METHOD(Should_not_fuse_multiply_add_in_strict_mode) {
+        Tokens tokens = Optimize({ a, b, mul, x, plus }, Optimizer::Mode::Strict);
+        AssertRange::AreEqual({ a, b, mul, x, plus }, tokens);
+    }
+
+    TEST_METHOD(Should_evaluate_fused_multiply_add_with_single_rounding) {
+        // (1+2^-30)*(1-2^-30) - 1 is -2^-60 only with single rounding
+        const double e = std::ldexp(1.0, -30);
+        Tokens tokens{ MakeToken(1 + e), MakeToken(1 - e), MakeToken(-1), MakeToken(Operator::FusedMulAdd) };
+        Assert::AreEqual(-std::ldexp(1.0, -60), Evaluator::Evaluate(tokens));
+    }
+};
+
+TEST_CLASS(PolynomialTests) {
+public:
+    static Ast::NodePtr Rewrite(const Tokens &tokens, Optimizer::PolynomialScheme scheme, Optimizer::Statistics *statistics = nullptr) {
+        Optimizer::Options options;
+        options.m_polynomials = scheme;
+        return Optimizer::Optimize(Ast::Build(tokens), options, statistics);
+    }
+
+    static void AssertSameValues(const Tokens &expected, const Ast::NodePtr &actual) {
+        for(double value : { -2.0, 0.0, 0.5, 3.0 }) {
+            Bindings bindings{ { L"x", value }, { L"a", 2 }, { L"b", -3 } };
+            Assert::AreEqual(Evaluator::Evaluate(expected, bindings), Evaluator::Evaluate(Ast::ToPostfix(actual), bindings));
+        }
+    }
+
+    TEST_METHOD(Should_not_rewrite_polynomials_by_default) {
+        Tokens tokens = Postfix(L"2*x*x*x + 3*x*x + 4*x + 5");
+        Assert::AreEqual(tokens.size(), Ast::ToPostfix(Optimizer::Optimize(Ast::Build(tokens))).size());
+    }
+
+    TEST_METHOD(Should_evaluate_cubic_polynomial_in_horner_form) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Postfix(L"2*x*x*x + 3*x*x + 4*x + 5");
+        Ast::NodePtr root = Rewrite(tokens, Optimizer::PolynomialScheme::Horner, &statistics);
+        Assert::IsTrue(Ast::Equal(Ast::Build(Postfix(L"((2*x + 3)*x + 4)*x + 5")), root));
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"horner"));
+        AssertSameValues(tokens, root);
+    }
+
+    TEST_METHOD(Should_collect_terms_of_same_degree) {
+        Tokens tokens = Postfix(L"x*x*2 - x + x*3*x + 1 - 4*x");
+        Ast::NodePtr root = Rewrite(tokens, Optimizer::PolynomialScheme::Horner);
+        Assert::IsTrue(Ast::Equal(Optimizer::Simplify(Ast::Build(Postfix(L"(5*x + -5)*x + 1"))), root));
+        AssertSameValues(tokens, root);
+    }
+
+    TEST_METHOD(Should_keep_coefficients_with_other_variables) {
+        Tokens tokens = Postfix(L"a*x*x*x + b*x*x + x + 1");
+        Ast::NodePtr root = Rewrite(tokens, Optimizer::PolynomialScheme::Horner);
+        Assert::IsTrue(Ast::Equal(Ast::Build(Postfix(L"((a*x + b)*x + 1)*x + 1")), root));
+        AssertSameValues(tokens, root);
+    }
+
+    TEST_METHOD(Should_evaluate_polynomial_with_estrin_scheme) {
+        Optimizer::Statistics statistics;
+        Tokens tokens = Postfix(L"2*x*x*x + 3*x*x + 4*x + 5");
+        Ast::NodePtr root = Rewrite(tokens, Optimizer::PolynomialScheme::Estrin, &statistics);
+        Assert::IsTrue(Ast::Equal(Ast::Build(Postfix(L"(5 + 4*x) + (3 + 2*x)*(x*x)")), root));
+        Assert::AreEqual(size_t(1), statistics.CountOf(L"estrin"));
+        AssertSameValues(tokens, root);
+    }
+
+    TEST_METHOD(Should_not_rewrite_when_it_is_not_shorter) {
+        Tokens tokens = Postfix(L"x*x + 1");
+        AssertRange::AreEqual({ x, x, mul, _1, plus }, Ast::ToPostfix(Rewrite(tokens, Optimizer::PolynomialScheme::Horner)));
+    }
+
+    TEST_METHOD(Should_divide_coefficients_by_other_variables) {
+        Tokens tokens = Postfix(L"x*x*x/a + x*x*2 + x");
+        Ast::NodePtr root = Rewrite(tokens, Optimizer::PolynomialScheme::Horner);
+        Assert::IsTrue(Ast::Equal(Ast::Build(Postfix(L"((1/a*x + 2)*x + 1)*x")), root));
+        AssertSameValues(tokens, root);
+    }
+
+    TEST_METHOD(Should_not_rewrite_division_by_polynomial) {
+        Tokens tokens = Postfix(L"x*x*x/(x+a) + x*x*2 + x");
+        Assert::AreEqual(tokens.size(), Ast::ToPostfix(Rewrite(tokens, Optimizer::PolynomialScheme::Horner)).size());
+    }
+};
+
+}
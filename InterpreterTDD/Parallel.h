@@ -0,0 +1,298 @@
+#pragma once
+#include "Ast.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace Interpreter {
+namespace Parallel {
+
+// Fixed set of threads, each with its own deque of tasks. A thread takes its newest task first
+// and steals the oldest from others when it runs out, so big tasks spawned early are the ones
+// that move between threads.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::max<unsigned>(std::thread::hardware_concurrency(), 1)) : m_queues(threads + 1) {
+        for(size_t i = 1; i <= threads; ++i) m_threads.emplace_back([this, i]() { Work(i); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for(auto &thread : m_threads) thread.join();
+    }
+
+    // Queue the task on the deque of the calling thread, threads outside the pool share one.
+    void Submit(std::function<void()> task) {
+        Queue &queue = m_queues[QueueIndex()];
+        {
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            queue.m_tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_queued;
+        }
+        m_wake.notify_one();
+    }
+
+    // Run one queued task on the calling thread, false when there is none. Lets a thread
+    // that waits for its tasks help instead of blocking.
+    bool RunOne() {
+        std::function<void()> task;
+        if(!Take(QueueIndex(), task)) return false;
+        task();
+        return true;
+    }
+
+    size_t Threads() const {
+        return m_threads.size();
+    }
+
+private:
+    struct Queue {
+        std::mutex m_mutex;
+        std::deque<std::function<void()>> m_tasks;
+    };
+
+    size_t QueueIndex() const {
+        return CurrentPool() == this ? CurrentIndex() : 0;
+    }
+
+    static const ThreadPool *&CurrentPool() {
+        static thread_local const ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    static size_t &CurrentIndex() {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    bool Take(size_t own, std::function<void()> &task) {
+        for(size_t i = 0; i < m_queues.size(); ++i) {
+            Queue &queue = m_queues[(own + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            if(queue.m_tasks.empty()) continue;
+            if(i == 0) {
+                task = std::move(queue.m_tasks.back());
+                queue.m_tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.m_tasks.front());
+                queue.m_tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> count(m_mutex);
+            --m_queued;
+            return true;
+        }
+        return false;
+    }
+
+    void Work(size_t index) {
+        CurrentPool() = this;
+        CurrentIndex() = index;
+        for(;;) {
+            if(RunOne()) continue;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stop || m_queued > 0; });
+            if(m_stop) return;
+        }
+    }
+
+    std::vector<Queue> m_queues;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    size_t m_queued = 0;
+    bool m_stop = false;
+};
+
+namespace Detail {
+
+using Ast::Node;
+
+inline double Apply(Operator op, const double *args) {
+    switch(op) {
+        case Operator::Plus: return args[0] + args[1];
+        case Operator::Minus: return args[0] - args[1];
+        case Operator::Mul: return args[0] * args[1];
+        case Operator::Div: return args[0] / args[1];
+        case Operator::UPlus: return args[0];
+        case Operator::UMinus: return -args[0];
+        case Operator::FusedMulAdd: return std::fma(args[0], args[1], args[2]);
+        default: throw std::logic_error("Operator can't be evaluated.");
+    }
+}
+
+// Value of the subtree evaluated with the task groups of its big subtrees running in the pool.
+// Only a node with more than one big argument forks, a chain is walked in a loop, so the depth
+// of nested tasks follows the number of forks and not the height of the tree.
+class Evaluation {
+public:
+    Evaluation(ThreadPool &pool, const Bindings &bindings, size_t threshold) : m_pool(pool), m_bindings(bindings), m_threshold(threshold) {}
+
+    double Run(const Ast::NodePtr &root) {
+        if(!root) return 0.0;
+        CountCosts(root.get());
+        return Evaluate(root.get());
+    }
+
+private:
+    struct Task {
+        std::atomic<bool> m_done{ false };
+        double m_value = 0.0;
+        std::exception_ptr m_error;
+    };
+
+    struct Frame {
+        const Node *m_node;
+        size_t m_next;
+        std::vector<double> m_args;
+        std::vector<std::pair<size_t, std::shared_ptr<Task>>> m_spawned;
+    };
+
+    void CountCosts(const Node *root) {
+        std::vector<std::pair<const Node *, bool>> pending{ { root, false } };
+        while(!pending.empty()) {
+            auto top = pending.back();
+            pending.pop_back();
+            if(m_costs.count(top.first)) continue;
+            if(top.second) {
+                size_t cost = 1;
+                for(const auto &arg : top.first->m_args) cost += m_costs.at(arg.get());
+                m_costs.emplace(top.first, cost);
+                continue;
+            }
+            pending.emplace_back(top.first, true);
+            for(const auto &arg : top.first->m_args) pending.emplace_back(arg.get(), false);
+        }
+    }
+
+    bool IsBig(const Node *node) const {
+        return m_costs.at(node) >= m_threshold;
+    }
+
+    double Evaluate(const Node *root) {
+        if(!IsBig(root)) return EvaluateInPlace(root);
+        std::vector<Frame> frames;
+        frames.push_back({ root, 0, std::vector<double>(root->m_args.size()), {} });
+        try {
+            return EvaluateFrames(frames);
+        }
+        catch(...) {
+            // Spawned tasks still use the tree and this evaluation, let them finish first.
+            for(const auto &frame : frames) {
+                for(const auto &spawned : frame.m_spawned) Wait(*spawned.second);
+            }
+            throw;
+        }
+    }
+
+    double EvaluateFrames(std::vector<Frame> &frames) {
+        double value = 0.0;
+        while(!frames.empty()) {
+            Frame &frame = frames.back();
+            const auto &args = frame.m_node->m_args;
+            if(frame.m_next < args.size()) {
+                const size_t i = frame.m_next++;
+                const Node *arg = args[i].get();
+                if(!IsBig(arg)) frame.m_args[i] = EvaluateInPlace(arg);
+                else if(std::any_of(args.begin() + i + 1, args.end(), [this](const Ast::NodePtr &next) { return IsBig(next.get()); })) {
+                    frame.m_spawned.emplace_back(i, Spawn(arg));
+                }
+                else frames.push_back({ arg, 0, std::vector<double>(arg->m_args.size()), {} });
+                continue;
+            }
+            std::exception_ptr error;
+            for(const auto &spawned : frame.m_spawned) {
+                Wait(*spawned.second);
+                if(spawned.second->m_error && !error) error = spawned.second->m_error;
+                frame.m_args[spawned.first] = spawned.second->m_value;
+            }
+            if(error) std::rethrow_exception(error);
+            frame.m_spawned.clear();
+            value = Apply(*PayloadOf<Operator>(frame.m_node->m_token), frame.m_args.data());
+            frames.pop_back();
+            if(!frames.empty()) frames.back().m_args[frames.back().m_next - 1] = value;
+        }
+        return value;
+    }
+
+    std::shared_ptr<Task> Spawn(const Node *node) {
+        auto task = std::make_shared<Task>();
+        m_pool.Submit([this, node, task]() {
+            try {
+                task->m_value = Evaluate(node);
+            }
+            catch(...) {
+                task->m_error = std::current_exception();
+            }
+            task->m_done.store(true, std::memory_order_release);
+        });
+        return task;
+    }
+
+    void Wait(const Task &task) {
+        while(!task.m_done.load(std::memory_order_acquire)) {
+            if(!m_pool.RunOne()) std::this_thread::yield();
+        }
+    }
+
+    // Small subtree on the calling thread, in postfix order with a stack of values.
+    double EvaluateInPlace(const Node *root) const {
+        std::vector<double> values;
+        std::vector<std::pair<const Node *, size_t>> pending{ { root, 0 } };
+        while(!pending.empty()) {
+            auto &top = pending.back();
+            const Node *node = top.first;
+            if(top.second < node->m_args.size()) {
+                pending.emplace_back(node->m_args[top.second++].get(), 0);
+                continue;
+            }
+            pending.pop_back();
+            if(const double *num = PayloadOf<double>(node->m_token)) values.push_back(*num);
+            else if(const Variable *variable = PayloadOf<Variable>(node->m_token)) {
+                auto value = m_bindings.find(variable->m_name);
+                if(value == m_bindings.end()) throw std::logic_error("Variable is not bound.");
+                values.push_back(value->second);
+            }
+            else {
+                const size_t arity = node->m_args.size();
+                const double result = Apply(*PayloadOf<Operator>(node->m_token), values.data() + values.size() - arity);
+                values.resize(values.size() - arity);
+                values.push_back(result);
+            }
+        }
+        return values.back();
+    }
+
+    ThreadPool &m_pool;
+    const Bindings &m_bindings;
+    const size_t m_threshold;
+    std::unordered_map<const Node *, size_t> m_costs;
+};
+} // namespace Detail
+
+// Evaluate the tree with independent subtrees of at least threshold nodes as tasks in the pool.
+// Every node computes the same operation on the same arguments as a sequential evaluation,
+// so the value is the same bit for bit whatever the schedule. A single node is never a task.
+inline double Evaluate(const Ast::NodePtr &root, ThreadPool &pool, const Bindings &bindings = {}, size_t threshold = 4096) {
+    Detail::Evaluation evaluation(pool, bindings, std::max<size_t>(threshold, 2));
+    return evaluation.Run(root);
+}
+} // namespace Parallel
+} // namespace Interpreter
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Parallel.h"
+#include "TestUtilities.h"
+#include <cstring>
+
+namespace InterpreterTests {
+
+TEST_CLASS(ParallelTests) {
+public:
+    // Balanced sum of products over alternating variables, every level forks.
+    static std::wstring BalancedExpression(int depth) {
+        if(depth == 0) return L"x*1.1";
+        const std::wstring half = BalancedExpression(depth - 1);
+        return L"(" + half + L")/3+(" + half + L"-y)*0.7";
+    }
+
+    TEST_METHOD(Should_evaluate_same_value_as_sequential_evaluation) {
+        Parallel::ThreadPool pool(4);
+        const Bindings bindings{ { L"x", 0.3 }, { L"y", 1.7 } };
+        const Tokens tokens = Postfix(BalancedExpression(10));
+        const double expected = Evaluator::Evaluate(tokens, bindings);
+        const Ast::NodePtr root = Ast::Build(tokens);
+        for(size_t threshold : { 1, 16, 1000, 1000000 }) {
+            for(int run = 0; run < 5; ++run) {
+                const double value = Parallel::Evaluate(root, pool, bindings, threshold);
+                Assert::IsTrue(std::memcmp(&expected, &value, sizeof(value)) == 0);
+            }
+        }
+    }
+
+    TEST_METHOD(Should_evaluate_long_chain_without_deep_nesting) {
+        Parallel::ThreadPool pool(2);
+        Tokens tokens{ _1 };
+        for(int i = 0; i < 100000; ++i) {
+            tokens.push_back(x);
+            tokens.push_back(plus);
+        }
+        Assert::AreEqual(Evaluator::Evaluate(tokens, { { L"x", 0.1 } }), Parallel::Evaluate(Ast::Build(tokens), pool, { { L"x", 0.1 } }, 64));
+    }
+
+    TEST_METHOD(Should_throw_when_variable_in_subtask_is_not_bound) {
+        Parallel::ThreadPool pool(2);
+        const Ast::NodePtr root = Ast::Build(Postfix(BalancedExpression(6)));
+        Assert::ExpectException<std::logic_error>([&]() { Parallel::Evaluate(root, pool, { { L"x", 1 } }, 8); });
+        Assert::AreEqual(Evaluator::Evaluate(Postfix(L"x*y"), { { L"x", 2 }, { L"y", 3 } }), Parallel::Evaluate(Ast::Build(Postfix(L"x*y")), pool, { { L"x", 2 }, { L"y", 3 } }, 1));
+    }
+
+    TEST_METHOD(Should_run_tasks_submitted_from_outside_pool) {
+        Parallel::ThreadPool pool(3);
+        std::atomic<int> done{ 0 };
+        for(int i = 0; i < 100; ++i) pool.Submit([&done]() { ++done; });
+        while(done < 100) {
+            if(!pool.RunOne()) std::this_thread::yield();
+        }
+        Assert::AreEqual(size_t(3), pool.Threads());
+    }
+};
+
+}
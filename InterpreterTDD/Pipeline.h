@@ -0,0 +1,149 @@
+#pragma once
+#include "Interpreter.h"
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace Interpreter {
+namespace Pipeline {
+
+// Lock-free queue between exactly one producer thread and one consumer thread. Each index
+// is written by one side only and lives on its own cache line.
+template<typename T> class SpscRing {
+public:
+    // Capacity is rounded up to a power of two.
+    explicit SpscRing(size_t capacity) : m_items(RoundUp(capacity)), m_mask(m_items.size() - 1) {}
+
+    bool TryPush(T &item) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_head.load(std::memory_order_acquire) == m_items.size()) return false;
+        m_items[tail & m_mask] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T &item) {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_tail.load(std::memory_order_acquire)) return false;
+        item = std::move(m_items[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Push(T item) {
+        while(!TryPush(item)) std::this_thread::yield();
+    }
+
+    T Pop() {
+        T item;
+        while(!TryPop(item)) std::this_thread::yield();
+        return item;
+    }
+
+    size_t Capacity() const {
+        return m_items.size();
+    }
+
+private:
+    static size_t RoundUp(size_t capacity) {
+        size_t size = 1;
+        while(size < capacity) size <<= 1;
+        return size;
+    }
+
+    std::vector<T> m_items;
+    const size_t m_mask;
+    alignas(64) std::atomic<size_t> m_head{ 0 };
+    alignas(64) std::atomic<size_t> m_tail{ 0 };
+};
+
+namespace Detail {
+
+// Tokens on their way between stages, the last item only marks the end of the stream.
+struct Item {
+    Tokens m_tokens;
+    std::exception_ptr m_error;
+    bool m_last = false;
+};
+
+template<typename F> void RunStage(SpscRing<Item> &input, SpscRing<Item> &output, F process) {
+    for(;;) {
+        Item item = input.Pop();
+        if(!item.m_last && !item.m_error) {
+            try {
+                item.m_tokens = process(item.m_tokens);
+            }
+            catch(...) {
+                item.m_error = std::current_exception();
+            }
+        }
+        const bool last = item.m_last;
+        output.Push(std::move(item));
+        if(last) return;
+    }
+}
+} // namespace Detail
+
+// Evaluate the stream of expressions with tokenizing, parsing and evaluation each on its own
+// thread, connected by ring buffers, so the slowest stage sets the pace instead of the sum.
+// next(expression) gives the next expression and returns false at the end, emit(value) gets the
+// values in the order of the expressions. The first error is thrown after all stages stopped.
+template<typename Next, typename Emit> void ProcessStream(Next next, Emit emit, const Bindings &bindings = {}, size_t capacity = 1024) {
+    SpscRing<Detail::Item> tokenized(capacity), parsed(capacity);
+    std::atomic<bool> stop{ false };
+    std::thread reader([&]() {
+        std::wstring expression;
+        for(;;) {
+            Detail::Item item;
+            try {
+                if(stop.load(std::memory_order_relaxed) || !next(expression)) break;
+                item.m_tokens = Lexer::MarkUnaryOperators(Lexer::Tokenize(expression));
+            }
+            catch(...) {
+                item.m_error = std::current_exception();
+            }
+            tokenized.Push(std::move(item));
+        }
+        Detail::Item last;
+        last.m_last = true;
+        tokenized.Push(std::move(last));
+    });
+    std::thread parser([&]() {
+        Detail::RunStage(tokenized, parsed, [](const Tokens &tokens) { return Parser::Parse(tokens); });
+    });
+    std::exception_ptr error;
+    for(;;) {
+        Detail::Item item = parsed.Pop();
+        if(item.m_last) break;
+        if(!error && item.m_error) {
+            error = item.m_error;
+            stop = true;
+        }
+        if(error) continue;
+        try {
+            emit(Evaluator::Evaluate(item.m_tokens, bindings));
+        }
+        catch(...) {
+            error = std::current_exception();
+            stop = true;
+        }
+    }
+    reader.join();
+    parser.join();
+    if(error) std::rethrow_exception(error);
+}
+
+// Values of all expressions in their order, computed in the pipeline.
+inline std::vector<double> EvaluateAll(const std::vector<std::wstring> &expressions, const Bindings &bindings = {}, size_t capacity = 1024) {
+    std::vector<double> values;
+    values.reserve(expressions.size());
+    size_t next = 0;
+    ProcessStream([&](std::wstring &expression) {
+        if(next == expressions.size()) return false;
+        expression = expressions[next++];
+        return true;
+    }, [&values](double value) { values.push_back(value); }, bindings, capacity);
+    return values;
+}
+} // namespace Pipeline
+} // namespace Interpreter
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Pipeline.h"
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(SpscRingTests) {
+public:
+    TEST_METHOD(Should_pop_items_in_order_of_push) {
+        Pipeline::SpscRing<int> ring(3);
+        Assert::AreEqual(size_t(4), ring.Capacity());
+        for(int round = 0; round < 3; ++round) {
+            for(int i = 0; i < 4; ++i) {
+                int item = round * 4 + i;
+                Assert::IsTrue(ring.TryPush(item));
+            }
+            int item = -1;
+            Assert::IsFalse(ring.TryPush(item));
+            for(int i = 0; i < 4; ++i) Assert::AreEqual(round * 4 + i, ring.Pop());
+            Assert::IsFalse(ring.TryPop(item));
+        }
+    }
+
+    TEST_METHOD(Should_pass_items_between_threads) {
+        Pipeline::SpscRing<int> ring(16);
+        std::thread producer([&ring]() {
+            for(int i = 0; i < 100000; ++i) ring.Push(i);
+        });
+        bool ordered = true;
+        for(int i = 0; i < 100000; ++i) ordered = ordered && ring.Pop() == i;
+        producer.join();
+        Assert::IsTrue(ordered);
+    }
+};
+
+TEST_CLASS(PipelineTests) {
+public:
+    TEST_METHOD(Should_evaluate_stream_in_order) {
+        std::vector<wstring> expressions;
+        for(int i = 0; i < 1000; ++i) expressions.push_back(L"(x+" + to_wstring(i) + L")*2-x");
+        const Bindings bindings{ { L"x", 0.25 } };
+        auto values = Pipeline::EvaluateAll(expressions, bindings, 8);
+        Assert::AreEqual(expressions.size(), values.size());
+        for(size_t i = 0; i < expressions.size(); ++i) Assert::AreEqual(InterpreteExperssion(expressions[i], bindings), values[i]);
+    }
+
+    TEST_METHOD(Should_return_nothing_for_empty_stream) {
+        Assert::IsTrue(Pipeline::EvaluateAll({}).empty());
+    }
+
+    TEST_METHOD(Should_throw_first_error_after_stopping) {
+        std::vector<wstring> expressions(100, L"1+1");
+        expressions[50] = L"(1+1";
+        expressions[70] = L"1+";
+        Assert::ExpectException<std::logic_error>([&expressions]() { Pipeline::EvaluateAll(expressions, {}, 4); });
+    }
+};
+
+}
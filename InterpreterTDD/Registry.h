@@ -0,0 +1,127 @@
+#pragma once
+#include "Compiler.h"
+#include "Epoch.h"
+#include <mutex>
+
+namespace Interpreter {
+namespace Registry {
+
+class Reader;
+
+// Compiled program published under a name with its version number.
+struct Version {
+    uint64_t m_number;
+    Compiler::Program m_program;
+};
+
+// Stable handle of a named formula, valid as long as the registry. It always points to
+// the latest published version, nullptr after the formula is removed.
+class Formula {
+public:
+    explicit Formula(std::wstring name) : m_name(std::move(name)), m_current(nullptr) {}
+
+    const std::wstring &Name() const {
+        return m_name;
+    }
+
+private:
+    friend class FormulaRegistry;
+    friend class Reader;
+
+    std::wstring m_name;
+    std::atomic<const Version *> m_current;
+    uint64_t m_versions = 0;
+};
+
+// Formulas updated while other threads evaluate them. Publishing swaps the program pointer
+// atomically, readers pick the new version up on their next evaluation without any lock.
+// A replaced version is freed through epochs once every reader that could still see it has
+// left its critical section.
+class FormulaRegistry {
+public:
+    FormulaRegistry() = default;
+    FormulaRegistry(const FormulaRegistry &) = delete;
+    FormulaRegistry &operator=(const FormulaRegistry &) = delete;
+
+    ~FormulaRegistry() {
+        for(const auto &formula : m_formulas) delete formula.second->m_current.load();
+    }
+
+    // Compile the expression and publish it under the name, compilation happens before any lock.
+    const Formula &Publish(const std::wstring &name, const std::wstring &expression, const Optimizer::Options &options = {}) {
+        return Publish(name, Compiler::Compile(Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression))), options));
+    }
+
+    const Formula &Publish(const std::wstring &name, Compiler::Program program) {
+        std::unique_ptr<Version> version(new Version{ 0, std::move(program) });
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &formula = m_formulas[name];
+        if(!formula) formula.reset(new Formula(name));
+        version->m_number = ++formula->m_versions;
+        Replace(*formula, version.release());
+        return *formula;
+    }
+
+    // Handle of the formula, nullptr when it was never published. Look it up once and keep it.
+    const Formula *Find(const std::wstring &name) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_formulas.find(name);
+        return found == m_formulas.end() ? nullptr : found->second.get();
+    }
+
+    void Remove(const std::wstring &name) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_formulas.find(name);
+        if(found != m_formulas.end()) Replace(*found->second, nullptr);
+    }
+
+    // Free versions no reader can see anymore.
+    void Collect() {
+        m_domain.Collect();
+    }
+
+    // Replaced versions waiting for readers to leave.
+    size_t Retired() const {
+        return m_domain.Retired();
+    }
+
+private:
+    friend class Reader;
+
+    void Replace(Formula &formula, const Version *version) {
+        const Version *old = formula.m_current.exchange(version);
+        if(old) m_domain.Retire(old);
+        m_domain.Collect();
+    }
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::wstring, std::unique_ptr<Formula>> m_formulas;
+    Epoch::Domain m_domain;
+};
+
+// Evaluates formulas of the registry on one thread, in working memory of its own. Creating
+// and destroying a reader takes a lock of the registry, reading never does.
+class Reader {
+public:
+    explicit Reader(FormulaRegistry &registry) : m_epoch(registry.m_domain) {}
+
+    // Call read(version) with the current version, which stays alive until read returns.
+    // Reads may nest, the epoch of the outermost one protects the versions of all of them.
+    template<typename F> auto Read(const Formula &formula, F read) -> decltype(read(std::declval<const Version &>())) {
+        return m_epoch.Read([&formula, &read]() -> decltype(read(std::declval<const Version &>())) {
+            const Version *version = formula.m_current.load();
+            if(!version) throw std::logic_error("Formula is removed.");
+            return read(*version);
+        });
+    }
+
+    double Evaluate(const Formula &formula, const Bindings &bindings = {}) {
+        return Read(formula, [this, &bindings](const Version &version) { return version.m_program.Evaluate(bindings, m_scratch); });
+    }
+
+private:
+    Epoch::Reader m_epoch;
+    Compiler::Scratch m_scratch;
+};
+} // namespace Registry
+} // namespace Interpreter
@@ -0,0 +1,90 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Registry.h"
+#include "TestUtilities.h"
+#include <thread>
+
+namespace InterpreterTests {
+
+TEST_CLASS(RegistryTests) {
+public:
+    TEST_METHOD(Should_evaluate_latest_published_version) {
+        Registry::FormulaRegistry registry;
+        Registry::Reader reader(registry);
+        const Registry::Formula &formula = registry.Publish(L"price", L"x*1.05");
+        Assert::AreEqual(2 * 1.05, reader.Evaluate(formula, { { L"x", 2 } }));
+        Assert::IsTrue(&formula == &registry.Publish(L"price", L"x*1.07"));
+        Assert::AreEqual(2 * 1.07, reader.Evaluate(formula, { { L"x", 2 } }));
+        Assert::AreEqual(uint64_t(2), reader.Read(formula, [](const Registry::Version &version) { return version.m_number; }));
+    }
+
+    TEST_METHOD(Should_find_published_formula_by_name) {
+        Registry::FormulaRegistry registry;
+        registry.Publish(L"a", L"1");
+        Assert::IsNotNull(registry.Find(L"a"));
+        Assert::IsNull(registry.Find(L"b"));
+    }
+
+    TEST_METHOD(Should_keep_version_until_reader_leaves) {
+        Registry::FormulaRegistry registry;
+        Registry::Reader reader(registry);
+        const Registry::Formula &formula = registry.Publish(L"f", L"1");
+        const double value = reader.Read(formula, [&](const Registry::Version &version) {
+            registry.Publish(L"f", L"2");
+            Assert::AreEqual(size_t(1), registry.Retired());
+            return version.m_program.Evaluate();
+        });
+        Assert::AreEqual(1.0, value);
+        registry.Collect();
+        Assert::AreEqual(size_t(0), registry.Retired());
+        Assert::AreEqual(2.0, reader.Evaluate(formula));
+    }
+
+    TEST_METHOD(Should_keep_outer_version_after_nested_read) {
+        Registry::FormulaRegistry registry;
+        Registry::Reader reader(registry);
+        const Registry::Formula &outer = registry.Publish(L"outer", L"1");
+        const Registry::Formula &inner = registry.Publish(L"inner", L"x*2");
+        const double value = reader.Read(outer, [&](const Registry::Version &version) {
+            const double nested = reader.Evaluate(inner, { { L"x", 3 } });
+            registry.Publish(L"outer", L"2");
+            registry.Collect();
+            Assert::AreEqual(size_t(1), registry.Retired());
+            return version.m_program.Evaluate() + nested;
+        });
+        Assert::AreEqual(7.0, value);
+    }
+
+    TEST_METHOD(Should_throw_when_formula_is_removed) {
+        Registry::FormulaRegistry registry;
+        Registry::Reader reader(registry);
+        const Registry::Formula &formula = registry.Publish(L"f", L"1");
+        registry.Remove(L"f");
+        Assert::ExpectException<std::logic_error>([&]() { reader.Evaluate(formula); });
+    }
+
+    TEST_METHOD(Should_read_consistent_versions_while_publishing) {
+        Registry::FormulaRegistry registry;
+        const Registry::Formula &formula = registry.Publish(L"f", L"x+0");
+        std::atomic<bool> done{ false };
+        std::atomic<int> wrong{ 0 };
+        std::vector<std::thread> readers;
+        for(int t = 0; t < 4; ++t) {
+            readers.emplace_back([&]() {
+                Registry::Reader reader(registry);
+                while(!done) {
+                    const double value = reader.Evaluate(formula, { { L"x", 0.5 } }) - 0.5;
+                    if(value != std::floor(value) || value < 0 || value > 200) ++wrong;
+                }
+            });
+        }
+        for(int k = 1; k <= 200; ++k) registry.Publish(L"f", L"x+" + to_wstring(k));
+        done = true;
+        for(auto &reader : readers) reader.join();
+        registry.Collect();
+        Assert::AreEqual(0, wrong.load());
+        Assert::AreEqual(size_t(0), registry.Retired());
+    }
+};
+
+}
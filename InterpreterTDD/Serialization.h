@@ -0,0 +1,658 @@
+#pragma once
+#include "Compiler.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Interpreter {
+namespace Serialization {
+
+// Version of the binary layout, change it with every change of the layout.
+const uint32_t FormatVersion = 3;
+
+// What the layout depends on besides the version: byte order and sizes of double and wchar_t.
+inline uint32_t AbiStamp() {
+    const uint16_t order = 1;
+    uint8_t littleEndian;
+    std::memcpy(&littleEndian, &order, 1);
+    return uint32_t(littleEndian) << 16 | uint32_t(sizeof(double)) << 8 | uint32_t(sizeof(wchar_t));
+}
+
+// 64-bit FNV-1a of the bytes.
+inline uint64_t Checksum(const uint8_t *data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+namespace Detail {
+
+// Program is stored as the header, constants, code and names of variables, every part at an
+// offset from the start, so a blob is valid at any address aligned to 8 bytes.
+struct ProgramHeader {
+    uint64_t m_checksum; // Of all bytes after it.
+    uint32_t m_size;
+    uint32_t m_code;
+    uint32_t m_constants;
+    uint32_t m_variables;
+    uint32_t m_parameters;
+    uint32_t m_slots;
+    uint32_t m_stackDepth;
+    uint32_t m_outputs;
+};
+
+struct EncodedInstruction {
+    uint32_t m_code;
+    uint32_t m_operand;
+};
+
+inline size_t AlignTo8(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+template<typename T> void Append(std::vector<uint8_t> &bytes, const T &value) {
+    const uint8_t *begin = reinterpret_cast<const uint8_t *>(&value);
+    bytes.insert(bytes.end(), begin, begin + sizeof(T));
+}
+
+template<typename T> T Load(const uint8_t *data) {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+inline void Corrupted() {
+    throw std::runtime_error("Program is corrupted.");
+}
+
+inline size_t ArityOf(Compiler::OpCode code) {
+    switch(code) {
+        case Compiler::OpCode::Constant:
+        case Compiler::OpCode::Variable:
+        case Compiler::OpCode::Parameter:
+        case Compiler::OpCode::Load:
+            return 0;
+        case Compiler::OpCode::Store:
+            return 1;
+        default:
+            return Ast::ArityOf(Compiler::Detail::OperatorOf(code));
+    }
+}
+
+// Check everything an evaluation relies on: the checksum, that all parts are inside the blob,
+// that every operand is in range and the stack never goes below empty or above its depth.
+inline ProgramHeader Verify(const uint8_t *data, size_t size) {
+    if(size < sizeof(ProgramHeader)) Corrupted();
+    const auto header = Load<ProgramHeader>(data);
+    if(header.m_size < sizeof(ProgramHeader) || header.m_size > size || header.m_size % 8) Corrupted();
+    if(Checksum(data + sizeof(uint64_t), header.m_size - sizeof(uint64_t)) != header.m_checksum) Corrupted();
+    const uint64_t namesOffset = sizeof(ProgramHeader) + uint64_t(header.m_constants) * sizeof(double) + uint64_t(header.m_code) * sizeof(EncodedInstruction);
+    if(namesOffset > header.m_size) Corrupted();
+    uint64_t offset = namesOffset;
+    for(uint32_t i = 0; i < header.m_variables; ++i) {
+        if(offset + sizeof(uint32_t) > header.m_size) Corrupted();
+        offset += sizeof(uint32_t) + uint64_t(Load<uint32_t>(data + offset)) * sizeof(uint32_t);
+    }
+    if(offset > header.m_size) Corrupted();
+    const uint8_t *code = data + sizeof(ProgramHeader) + size_t(header.m_constants) * sizeof(double);
+    const uint32_t limits[] = { header.m_constants, header.m_variables, header.m_parameters, header.m_slots, header.m_slots, header.m_outputs };
+    size_t depth = 0;
+    for(uint32_t i = 0; i < header.m_code; ++i) {
+        const auto instruction = Load<EncodedInstruction>(code + i * sizeof(EncodedInstruction));
+        if(instruction.m_code > uint32_t(Compiler::OpCode::FusedMultiplyAdd)) Corrupted();
+        const auto opCode = static_cast<Compiler::OpCode>(instruction.m_code);
+        if(instruction.m_code <= uint32_t(Compiler::OpCode::Output) && instruction.m_operand >= limits[instruction.m_code]) Corrupted();
+        const size_t arity = opCode == Compiler::OpCode::Output ? 1 : ArityOf(opCode);
+        if(depth < arity) Corrupted();
+        if(opCode == Compiler::OpCode::Output) --depth;
+        else if(opCode != Compiler::OpCode::Store) depth = depth - arity + 1;
+        if(depth > header.m_stackDepth) Corrupted();
+    }
+    if(depth != (header.m_outputs || header.m_code == 0 ? 0 : 1)) Corrupted();
+    return header;
+}
+
+class ProgramReader {
+public:
+    static Compiler::Program Read(const uint8_t *data, size_t size) {
+        const auto header = Verify(data, size);
+        Compiler::Program program;
+        const uint8_t *next = data + sizeof(ProgramHeader);
+        for(uint32_t i = 0; i < header.m_constants; ++i, next += sizeof(double)) {
+            program.m_constants.push_back(Load<double>(next));
+        }
+        for(uint32_t i = 0; i < header.m_code; ++i, next += sizeof(EncodedInstruction)) {
+            const auto instruction = Load<EncodedInstruction>(next);
+            program.m_code.push_back({ static_cast<Compiler::OpCode>(instruction.m_code), instruction.m_operand });
+        }
+        for(uint32_t i = 0; i < header.m_variables; ++i) {
+            std::wstring name(Load<uint32_t>(next), L'\0');
+            next += sizeof(uint32_t);
+            for(auto &ch : name) {
+                ch = static_cast<wchar_t>(Load<uint32_t>(next));
+                next += sizeof(uint32_t);
+            }
+            program.m_variables.push_back(std::move(name));
+        }
+        program.m_parameters = header.m_parameters;
+        program.m_slots = header.m_slots;
+        program.m_stackDepth = header.m_stackDepth;
+        program.m_outputs = header.m_outputs;
+        return program;
+    }
+};
+} // namespace Detail
+
+// Position-independent binary form of the program.
+inline std::vector<uint8_t> Serialize(const Compiler::Program &program) {
+    const auto &code = program.Code();
+    Detail::ProgramHeader header = {};
+    header.m_code = static_cast<uint32_t>(code.size());
+    header.m_constants = static_cast<uint32_t>(program.Constants().size());
+    header.m_variables = static_cast<uint32_t>(program.Variables().size());
+    header.m_parameters = static_cast<uint32_t>(program.Parameters());
+    header.m_slots = static_cast<uint32_t>(program.Slots());
+    header.m_stackDepth = static_cast<uint32_t>(program.StackDepth());
+    header.m_outputs = static_cast<uint32_t>(std::count_if(code.cbegin(), code.cend(), [](const Compiler::Instruction &i) { return i.m_code == Compiler::OpCode::Output; }));
+    std::vector<uint8_t> bytes(sizeof(header));
+    for(double constant : program.Constants()) Detail::Append(bytes, constant);
+    for(const auto &instruction : code) Detail::Append(bytes, Detail::EncodedInstruction{ uint32_t(instruction.m_code), instruction.m_operand });
+    for(const auto &name : program.Variables()) {
+        Detail::Append(bytes, static_cast<uint32_t>(name.size()));
+        for(wchar_t ch : name) Detail::Append(bytes, static_cast<uint32_t>(ch));
+    }
+    bytes.resize(Detail::AlignTo8(bytes.size()));
+    header.m_size = static_cast<uint32_t>(bytes.size());
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    header.m_checksum = Checksum(bytes.data() + sizeof(uint64_t), bytes.size() - sizeof(uint64_t));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    return bytes;
+}
+
+// Read the program back, throws when the bytes are not a valid program.
+inline Compiler::Program Deserialize(const uint8_t *data, size_t size) {
+    return Detail::ProgramReader::Read(data, size);
+}
+
+inline Compiler::Program Deserialize(const std::vector<uint8_t> &bytes) {
+    return Deserialize(bytes.data(), bytes.size());
+}
+
+// Serialized program evaluated where it lies, in a mapped file or shared memory, without
+// copying it out. The bytes are verified once on construction and must outlive the view.
+class ProgramView {
+public:
+    ProgramView(const uint8_t *data, size_t size) : m_data(data), m_header(Detail::Verify(data, size)) {}
+
+    explicit ProgramView(std::pair<const uint8_t *, size_t> stored) : ProgramView(stored.first, stored.second) {}
+
+    // Evaluate with variables looked up by name.
+    double Evaluate(const Bindings &bindings = {}, const std::vector<double> &parameters = {}) const {
+        Compiler::Scratch scratch;
+        return Evaluate(bindings, scratch, parameters);
+    }
+
+    // Evaluate with variables looked up by name, without allocating once the scratch has grown.
+    double Evaluate(const Bindings &bindings, Compiler::Scratch &scratch, const std::vector<double> &parameters = {}) const {
+        if(m_header.m_outputs > 1) throw std::logic_error("Program has several outputs.");
+        double *const values = scratch.Reserve(size_t(m_header.m_variables) + m_header.m_stackDepth + m_header.m_slots);
+        ValuesOf(bindings, scratch.Name(), values);
+        double result = 0.0;
+        Run(values, parameters, &result, values + m_header.m_variables);
+        return result;
+    }
+
+    // Evaluate with values of variables in order of Variables().
+    double Evaluate(const std::vector<double> &variables, const std::vector<double> &parameters = {}) const {
+        Compiler::Scratch scratch;
+        return Evaluate(variables, scratch, parameters);
+    }
+
+    double Evaluate(const std::vector<double> &variables, Compiler::Scratch &scratch, const std::vector<double> &parameters = {}) const {
+        if(m_header.m_outputs > 1) throw std::logic_error("Program has several outputs.");
+        if(variables.size() != m_header.m_variables) throw std::logic_error("Wrong number of variables.");
+        double result = 0.0;
+        Run(variables.data(), parameters, &result, scratch.Reserve(size_t(m_header.m_stackDepth) + m_header.m_slots));
+        return result;
+    }
+
+    std::vector<double> EvaluateAll(const std::vector<double> &variables, const std::vector<double> &parameters = {}) const {
+        if(variables.size() != m_header.m_variables) throw std::logic_error("Wrong number of variables.");
+        std::vector<double> results(std::max<size_t>(m_header.m_outputs, 1));
+        Compiler::Scratch scratch;
+        Run(variables.data(), parameters, results.data(), scratch.Reserve(size_t(m_header.m_stackDepth) + m_header.m_slots));
+        return results;
+    }
+
+    // Evaluate all formulas into the results, which allocates only when they have to grow.
+    void EvaluateAll(const Bindings &bindings, Compiler::Scratch &scratch, std::vector<double> &results, const std::vector<double> &parameters = {}) const {
+        double *const values = scratch.Reserve(size_t(m_header.m_variables) + m_header.m_stackDepth + m_header.m_slots);
+        ValuesOf(bindings, scratch.Name(), values);
+        results.assign(std::max<size_t>(m_header.m_outputs, 1), 0.0);
+        Run(values, parameters, results.data(), values + m_header.m_variables);
+    }
+
+    std::vector<std::wstring> Variables() const {
+        std::vector<std::wstring> names(m_header.m_variables);
+        const uint8_t *next = Names();
+        for(auto &name : names) next = ReadName(next, name);
+        return names;
+    }
+
+    size_t Parameters() const {
+        return m_header.m_parameters;
+    }
+
+    size_t StackDepth() const {
+        return m_header.m_stackDepth;
+    }
+
+private:
+    const uint8_t *Names() const {
+        return m_data + sizeof(Detail::ProgramHeader) + size_t(m_header.m_constants) * sizeof(double) + size_t(m_header.m_code) * sizeof(Detail::EncodedInstruction);
+    }
+
+    static const uint8_t *ReadName(const uint8_t *next, std::wstring &name) {
+        name.assign(Detail::Load<uint32_t>(next), L'\0');
+        next += sizeof(uint32_t);
+        for(auto &ch : name) {
+            ch = static_cast<wchar_t>(Detail::Load<uint32_t>(next));
+            next += sizeof(uint32_t);
+        }
+        return next;
+    }
+
+    // Names are read one by one into the buffer, which allocates only while it grows.
+    void ValuesOf(const Bindings &bindings, std::wstring &name, double *values) const {
+        const uint8_t *next = Names();
+        for(uint32_t i = 0; i < m_header.m_variables; ++i) {
+            next = ReadName(next, name);
+            auto value = bindings.find(name);
+            if(value == bindings.end()) throw std::logic_error("Variable is not bound.");
+            values[i] = value->second;
+        }
+    }
+
+    // Memory holds the stack followed by the slots.
+    void Run(const double *variables, const std::vector<double> &parameters, double *outputs, double *memory) const {
+        using Compiler::OpCode;
+        if(parameters.size() != m_header.m_parameters) throw std::logic_error("Wrong number of parameters.");
+        const uint8_t *constants = m_data + sizeof(Detail::ProgramHeader);
+        const uint8_t *code = constants + size_t(m_header.m_constants) * sizeof(double);
+        double *const stack = memory;
+        double *const slots = stack + m_header.m_stackDepth;
+        double *top = stack;
+        for(uint32_t i = 0; i < m_header.m_code; ++i) {
+            const auto instruction = Detail::Load<Detail::EncodedInstruction>(code + i * sizeof(Detail::EncodedInstruction));
+            switch(static_cast<OpCode>(instruction.m_code)) {
+                case OpCode::Constant: *top++ = Detail::Load<double>(constants + instruction.m_operand * sizeof(double)); break;
+                case OpCode::Variable: *top++ = variables[instruction.m_operand]; break;
+                case OpCode::Parameter: *top++ = parameters[instruction.m_operand]; break;
+                case OpCode::Store: slots[instruction.m_operand] = top[-1]; break;
+                case OpCode::Load: *top++ = slots[instruction.m_operand]; break;
+                case OpCode::Output: outputs[instruction.m_operand] = *--top; break;
+                case OpCode::Add: --top; top[-1] = top[-1] + top[0]; break;
+                case OpCode::Subtract: --top; top[-1] = top[-1] - top[0]; break;
+                case OpCode::Multiply: --top; top[-1] = top[-1] * top[0]; break;
+                case OpCode::Divide: --top; top[-1] = top[-1] / top[0]; break;
+                case OpCode::Negate: top[-1] = -top[-1]; break;
+                case OpCode::FusedMultiplyAdd: top -= 2; top[-1] = std::fma(top[-1], top[0], top[1]); break;
+            }
+        }
+        if(top != stack) outputs[0] = top[-1];
+    }
+
+    const uint8_t *m_data;
+    Detail::ProgramHeader m_header;
+};
+
+// Read-only view of the whole file in memory, the system loads pages on first access.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(m_file == INVALID_HANDLE_VALUE) throw std::runtime_error("Can't open file.");
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(m_file, &size)) Fail();
+        m_size = static_cast<size_t>(size.QuadPart);
+        if(m_size == 0) return;
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!m_mapping) Fail();
+        m_data = static_cast<const uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if(!m_data) Fail();
+#else
+        const int file = open(path.c_str(), O_RDONLY);
+        if(file < 0) throw std::runtime_error("Can't open file.");
+        struct stat status;
+        const bool known = fstat(file, &status) == 0;
+        m_size = known ? static_cast<size_t>(status.st_size) : 0;
+        void *data = known && m_size ? mmap(nullptr, m_size, PROT_READ, MAP_SHARED, file, 0) : nullptr;
+        close(file);
+        if(!known || data == MAP_FAILED) throw std::runtime_error("Can't map file.");
+        m_data = static_cast<const uint8_t *>(data);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        Close();
+    }
+
+    const uint8_t *Data() const {
+        return m_data;
+    }
+
+    size_t Size() const {
+        return m_size;
+    }
+
+private:
+    void Close() {
+#ifdef _WIN32
+        if(m_data) UnmapViewOfFile(m_data);
+        if(m_mapping) CloseHandle(m_mapping);
+        if(m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+        if(m_data) munmap(const_cast<uint8_t *>(m_data), m_size);
+#endif
+    }
+
+#ifdef _WIN32
+    void Fail() {
+        Close();
+        throw std::runtime_error("Can't map file.");
+    }
+
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Named memory shared by all processes that open it, zero-filled when created.
+class SharedMemory {
+public:
+    SharedMemory(const std::string &name, size_t size) : m_size(size) {
+#ifdef _WIN32
+        const uint64_t size64 = size;
+        m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, DWORD(size64 >> 32), DWORD(size64), ("Local\\" + name).c_str());
+        if(!m_mapping) throw std::runtime_error("Can't open shared memory.");
+        m_data = static_cast<uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+        if(!m_data) {
+            CloseHandle(m_mapping);
+            throw std::runtime_error("Can't map shared memory.");
+        }
+#else
+        const int file = shm_open(("/" + name).c_str(), O_CREAT | O_RDWR, 0600);
+        if(file < 0) throw std::runtime_error("Can't open shared memory.");
+        struct stat status;
+        bool sized = fstat(file, &status) == 0 && (status.st_size == off_t(size) || (status.st_size == 0 && ftruncate(file, off_t(size)) == 0));
+        void *data = sized ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+        close(file);
+        if(data == MAP_FAILED) throw std::runtime_error("Can't map shared memory.");
+        m_data = static_cast<uint8_t *>(data);
+#endif
+    }
+
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+
+    ~SharedMemory() {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+#else
+        munmap(m_data, m_size);
+#endif
+    }
+
+    // Remove the name, memory is released when the last process unmaps it. Windows does it by itself.
+    static void Remove(const std::string &name) {
+#ifndef _WIN32
+        shm_unlink(("/" + name).c_str());
+#endif
+    }
+
+    uint8_t *Data() const {
+        return m_data;
+    }
+
+    size_t Size() const {
+        return m_size;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE m_mapping = nullptr;
+#endif
+    uint8_t *m_data = nullptr;
+    size_t m_size;
+};
+
+namespace Detail {
+
+struct FileHeader {
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_abi;
+    uint64_t m_entries;
+    uint64_t m_options;
+};
+
+// Index is sorted by hash of the key, keys and programs follow it.
+struct IndexEntry {
+    uint64_t m_hash;
+    uint64_t m_keyOffset;
+    uint64_t m_programOffset;
+    uint32_t m_keyLength;
+    uint32_t m_programSize;
+};
+
+const char FileMagic[8] = { 'I', 'T', 'D', 'D', 'P', 'R', 'G', '\0' };
+
+// Write the bytes to a temporary file of its own next to the path and flush them to the disk,
+// then rename it over the path and flush the directory. A reader sees either the old file or
+// the whole new one, even after a crash or with other processes saving at the same time.
+inline void ReplaceFile(const std::string &path, const std::vector<uint8_t> &bytes) {
+#ifdef _WIN32
+    static std::atomic<uint32_t> counter{ 0 };
+    const std::string temporary = path + "." + std::to_string(GetCurrentProcessId()) + "." + std::to_string(counter++) + ".tmp";
+    HANDLE file = CreateFileA(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) throw std::runtime_error("Can't write file.");
+    DWORD written = 0;
+    const bool flushed = WriteFile(file, bytes.data(), DWORD(bytes.size()), &written, nullptr) && written == bytes.size() && FlushFileBuffers(file);
+    CloseHandle(file);
+    auto wide = [](const std::string &narrow) {
+        std::wstring result(MultiByteToWideChar(CP_ACP, 0, narrow.c_str(), -1, nullptr, 0), L'\0');
+        MultiByteToWideChar(CP_ACP, 0, narrow.c_str(), -1, &result[0], int(result.size()));
+        return result;
+    };
+    // Writing through flushes the directory entry as well.
+    if(!flushed || !MoveFileExW(wide(temporary).c_str(), wide(path).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        DeleteFileA(temporary.c_str());
+        throw std::runtime_error("Can't write file.");
+    }
+#else
+    std::string temporary = path + ".XXXXXX";
+    const int file = mkstemp(&temporary[0]);
+    if(file < 0) throw std::runtime_error("Can't write file.");
+    size_t written = 0;
+    while(written < bytes.size()) {
+        const ssize_t count = write(file, bytes.data() + written, bytes.size() - written);
+        if(count <= 0) break;
+        written += size_t(count);
+    }
+    const bool flushed = written == bytes.size() && fchmod(file, 0644) == 0 && fsync(file) == 0;
+    close(file);
+    if(!flushed || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        throw std::runtime_error("Can't write file.");
+    }
+    const size_t slash = path.find_last_of('/');
+    const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    const int entry = open(directory.c_str(), O_RDONLY);
+    const bool durable = entry >= 0 && fsync(entry) == 0;
+    if(entry >= 0) close(entry);
+    if(!durable) throw std::runtime_error("Can't write file.");
+#endif
+}
+} // namespace Detail
+
+// What compiled programs depend on besides the expression, programs compiled with other
+// options may give other results.
+inline uint64_t OptionsStamp(const Optimizer::Options &options) {
+    std::vector<uint8_t> fields;
+    Detail::Append(fields, static_cast<uint32_t>(options.m_mode));
+    Detail::Append(fields, static_cast<uint32_t>(options.m_reassociation));
+    Detail::Append(fields, static_cast<uint64_t>(options.m_accumulators));
+    Detail::Append(fields, static_cast<uint32_t>(options.m_polynomials));
+    Detail::Append(fields, static_cast<uint32_t>(options.m_fuseMultiplyAdd));
+    return Checksum(fields.data(), fields.size());
+}
+
+// Programs by key to be written to a file.
+typedef std::vector<std::pair<std::wstring, std::vector<uint8_t>>> Entries;
+
+// Write serialized programs with their keys and the options they were compiled with to a new
+// file that replaces the old one.
+inline void WriteProgramFile(const std::string &path, Entries entries, const Optimizer::Options &options = {}) {
+    std::vector<std::pair<uint64_t, size_t>> order;
+    for(size_t i = 0; i < entries.size(); ++i) order.emplace_back(Canonical::Hash(entries[i].first), i);
+    std::sort(order.begin(), order.end());
+    Detail::FileHeader header = {};
+    std::memcpy(header.m_magic, Detail::FileMagic, sizeof(header.m_magic));
+    header.m_version = FormatVersion;
+    header.m_abi = AbiStamp();
+    header.m_entries = entries.size();
+    header.m_options = OptionsStamp(options);
+    std::vector<Detail::IndexEntry> index;
+    std::vector<uint8_t> data;
+    size_t offset = sizeof(header) + entries.size() * sizeof(Detail::IndexEntry);
+    for(const auto &item : order) {
+        const auto &entry = entries[item.second];
+        Detail::IndexEntry indexEntry = {};
+        indexEntry.m_hash = item.first;
+        indexEntry.m_keyOffset = offset + data.size();
+        indexEntry.m_keyLength = static_cast<uint32_t>(entry.first.size());
+        for(wchar_t ch : entry.first) Detail::Append(data, static_cast<uint32_t>(ch));
+        data.resize(Detail::AlignTo8(data.size()));
+        indexEntry.m_programOffset = offset + data.size();
+        indexEntry.m_programSize = static_cast<uint32_t>(entry.second.size());
+        data.insert(data.end(), entry.second.cbegin(), entry.second.cend());
+        data.resize(Detail::AlignTo8(data.size()));
+        index.push_back(indexEntry);
+    }
+    std::vector<uint8_t> bytes(sizeof(header) + index.size() * sizeof(Detail::IndexEntry));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    if(!index.empty()) std::memcpy(bytes.data() + sizeof(header), index.data(), index.size() * sizeof(Detail::IndexEntry));
+    bytes.insert(bytes.end(), data.cbegin(), data.cend());
+    Detail::ReplaceFile(path, bytes);
+}
+
+// Compile the expressions to a pack file of programs keyed by expression text.
+inline void WritePack(const std::string &path, const std::vector<std::wstring> &expressions, const Optimizer::Options &options = {}) {
+    Entries entries;
+    for(const auto &expression : expressions) {
+        const Tokens tokens = Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression)));
+        entries.emplace_back(expression, Serialize(Compiler::Compile(tokens, options)));
+    }
+    WriteProgramFile(path, std::move(entries), options);
+}
+
+// Memory-mapped file of programs by key. Only the header is checked on open,
+// programs are returned as they are stored and have to be verified before use.
+class ProgramFile {
+public:
+    explicit ProgramFile(const std::string &path) : m_file(path) {
+        if(m_file.Size() < sizeof(Detail::FileHeader)) throw std::runtime_error("Incompatible program file.");
+        const auto header = Detail::Load<Detail::FileHeader>(m_file.Data());
+        if(std::memcmp(header.m_magic, Detail::FileMagic, sizeof(header.m_magic)) != 0 || header.m_version != FormatVersion || header.m_abi != AbiStamp()) {
+            throw std::runtime_error("Incompatible program file.");
+        }
+        if(header.m_entries > (m_file.Size() - sizeof(header)) / sizeof(Detail::IndexEntry)) throw std::runtime_error("Program file is corrupted.");
+        m_entries = static_cast<size_t>(header.m_entries);
+        m_options = header.m_options;
+    }
+
+    size_t Size() const {
+        return m_entries;
+    }
+
+    // Stamp of the options the programs were compiled with.
+    uint64_t OptionsStamp() const {
+        return m_options;
+    }
+
+    std::wstring KeyAt(size_t i) const {
+        const auto entry = EntryAt(i);
+        std::wstring key(entry.m_keyLength, L'\0');
+        for(size_t ch = 0; ch < key.size(); ++ch) {
+            key[ch] = static_cast<wchar_t>(Detail::Load<uint32_t>(m_file.Data() + entry.m_keyOffset + ch * sizeof(uint32_t)));
+        }
+        return key;
+    }
+
+    std::pair<const uint8_t *, size_t> ProgramAt(size_t i) const {
+        const auto entry = EntryAt(i);
+        return{ m_file.Data() + entry.m_programOffset, entry.m_programSize };
+    }
+
+    // View of the program stored under the key, evaluated straight from the mapped file.
+    ProgramView View(const std::wstring &key) const {
+        const auto stored = Find(key);
+        if(!stored.first) throw std::runtime_error("Program is not found.");
+        return ProgramView(stored);
+    }
+
+    // Serialized program stored under the key, nullptr when there is none.
+    std::pair<const uint8_t *, size_t> Find(const std::wstring &key) const {
+        const uint64_t hash = Canonical::Hash(key);
+        size_t first = 0, last = m_entries;
+        while(first < last) {
+            const size_t middle = first + (last - first) / 2;
+            if(EntryAt(middle).m_hash < hash) first = middle + 1;
+            else last = middle;
+        }
+        for(; first < m_entries && EntryAt(first).m_hash == hash; ++first) {
+            if(KeyAt(first) == key) return ProgramAt(first);
+        }
+        return{ nullptr, 0 };
+    }
+
+private:
+    Detail::IndexEntry EntryAt(size_t i) const {
+        const auto entry = Detail::Load<Detail::IndexEntry>(m_file.Data() + sizeof(Detail::FileHeader) + i * sizeof(Detail::IndexEntry));
+        const bool inside = entry.m_keyOffset <= m_file.Size() && entry.m_keyLength <= (m_file.Size() - entry.m_keyOffset) / sizeof(uint32_t)
+            && entry.m_programOffset <= m_file.Size() && entry.m_programSize <= m_file.Size() - entry.m_programOffset;
+        if(!inside) throw std::runtime_error("Program file is corrupted.");
+        return entry;
+    }
+
+    MappedFile m_file;
+    size_t m_entries = 0;
+    uint64_t m_options = 0;
+};
+} // namespace Serialization
+} // namespace Interpreter
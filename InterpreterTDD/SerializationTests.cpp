@@ -0,0 +1,184 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "Serialization.h"
+#include <thread>
+#include "TestUtilities.h"
+
+namespace InterpreterTests {
+
+TEST_CLASS(SerializationTests) {
+public:
+    static Compiler::Program RoundTrip(const Compiler::Program &program) {
+        return Serialization::Deserialize(Serialization::Serialize(program));
+    }
+
+    TEST_METHOD(Should_read_back_same_program) {
+        Compiler::Program program = Compiler::Compile(Postfix(L"(a+b)*(a+b) - x/3"));
+        Compiler::Program read = RoundTrip(program);
+        Assert::IsTrue(program.Code() == read.Code());
+        Assert::IsTrue(program.Constants() == read.Constants());
+        Assert::IsTrue(program.Variables() == read.Variables());
+        Assert::AreEqual(program.Slots(), read.Slots());
+        Assert::AreEqual(program.StackDepth(), read.StackDepth());
+    }
+
+    TEST_METHOD(Should_read_back_parameters_and_outputs) {
+        Compiler::Program shape = RoundTrip(Compiler::CompileShape(Ast::Build(Postfix(L"x*2"))));
+        Assert::AreEqual(6.0, shape.Evaluate(std::vector<double>{ 3 }, { 2 }));
+        Compiler::Program outputs = RoundTrip(Compiler::Compile(std::vector<Tokens>{ Postfix(L"x+1"), Postfix(L"x-1") }));
+        Assert::AreEqual(size_t(2), outputs.Outputs());
+        Assert::AreEqual(4.0, outputs.EvaluateAll({ { L"x", 5 } })[1]);
+    }
+
+    TEST_METHOD(Should_throw_when_program_is_corrupted) {
+        auto bytes = Serialization::Serialize(Compiler::Compile(Postfix(L"a*2")));
+        bytes.back() ^= 1;
+        Assert::ExpectException<std::runtime_error>([&bytes]() { Serialization::Deserialize(bytes); });
+    }
+
+    TEST_METHOD(Should_throw_when_program_is_truncated) {
+        auto bytes = Serialization::Serialize(Compiler::Compile(Postfix(L"a*2")));
+        bytes.resize(bytes.size() - 8);
+        Assert::ExpectException<std::runtime_error>([&bytes]() { Serialization::Deserialize(bytes); });
+    }
+
+    TEST_METHOD(Should_throw_when_operand_is_out_of_range) {
+        auto bytes = Serialization::Serialize(Compiler::Compile(Postfix(L"a*2")));
+        auto header = Serialization::Detail::Load<Serialization::Detail::ProgramHeader>(bytes.data());
+        const size_t code = sizeof(header) + header.m_constants * sizeof(double);
+        const uint32_t operand = 7;
+        std::memcpy(bytes.data() + code + sizeof(uint32_t), &operand, sizeof(operand));
+        header.m_checksum = Serialization::Checksum(bytes.data() + sizeof(uint64_t), bytes.size() - sizeof(uint64_t));
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        Assert::ExpectException<std::runtime_error>([&bytes]() { Serialization::Deserialize(bytes); });
+    }
+
+    TEST_METHOD(Should_find_programs_in_file_by_key) {
+        const std::string path = "SerializationTests.programs";
+        Serialization::WriteProgramFile(path, {
+            { L"a+1", Serialization::Serialize(Compiler::Compile(Postfix(L"a+1"))) },
+            { L"a*2", Serialization::Serialize(Compiler::Compile(Postfix(L"a*2"))) } });
+        {
+            Serialization::ProgramFile file(path);
+            Assert::AreEqual(size_t(2), file.Size());
+            auto stored = file.Find(L"a*2");
+            Assert::IsNotNull(stored.first);
+            Assert::AreEqual(6.0, Serialization::Deserialize(stored.first, stored.second).Evaluate({ { L"a", 3 } }));
+            Assert::IsNull(file.Find(L"a*3").first);
+        }
+        std::remove(path.c_str());
+    }
+
+    TEST_METHOD(Should_replace_file_with_options_stamp) {
+        const std::string path = "SerializationTests.replaced";
+        Optimizer::Options options;
+        options.m_mode = Optimizer::Mode::FastMath;
+        Serialization::WriteProgramFile(path, { { L"a", Serialization::Serialize(Compiler::Compile(Postfix(L"a"))) } });
+        Serialization::WriteProgramFile(path, { { L"b", Serialization::Serialize(Compiler::Compile(Postfix(L"b"), options)) } }, options);
+        {
+            Serialization::ProgramFile file(path);
+            Assert::IsNull(file.Find(L"a").first);
+            Assert::IsNotNull(file.Find(L"b").first);
+            Assert::AreEqual(Serialization::OptionsStamp(options), file.OptionsStamp());
+            Assert::IsTrue(Serialization::OptionsStamp(options) != Serialization::OptionsStamp({}));
+        }
+        Assert::IsFalse(std::ifstream(path + ".tmp").good());
+        std::remove(path.c_str());
+    }
+
+    TEST_METHOD(Should_replace_file_whole_when_saved_concurrently) {
+        const std::string path = "SerializationTests.concurrent";
+        std::vector<std::thread> writers;
+        for(int writer = 0; writer < 8; ++writer) {
+            writers.emplace_back([&path, writer]() {
+                Serialization::Entries entries;
+                for(int i = 0; i < 64; ++i) {
+                    const std::wstring key = L"x+" + std::to_wstring(writer * 64 + i);
+                    entries.emplace_back(key, Serialization::Serialize(Compiler::Compile(Postfix(key))));
+                }
+                for(int round = 0; round < 8; ++round) Serialization::WriteProgramFile(path, entries);
+            });
+        }
+        for(auto &writer : writers) writer.join();
+        {
+            Serialization::ProgramFile file(path);
+            Assert::AreEqual(size_t(64), file.Size());
+            const std::wstring first = file.KeyAt(0);
+            const int writer = std::stoi(first.substr(2)) / 64;
+            for(int i = 0; i < 64; ++i) Assert::IsNotNull(file.Find(L"x+" + std::to_wstring(writer * 64 + i)).first);
+        }
+        std::remove(path.c_str());
+    }
+
+    TEST_METHOD(Should_throw_and_keep_file_when_directory_is_missing) {
+        const std::string path = "SerializationTests.missing/programs";
+        Assert::ExpectException<std::runtime_error>([&path]() { Serialization::WriteProgramFile(path, {}); });
+        Assert::IsFalse(std::ifstream(path).good());
+    }
+
+    TEST_METHOD(Should_throw_when_file_has_other_format) {
+        const std::string path = "SerializationTests.other";
+        {
+            std::ofstream file(path, std::ios::binary);
+            file << "not a program file at all";
+        }
+        Assert::ExpectException<std::runtime_error>([&path]() { Serialization::ProgramFile file(path); });
+        std::remove(path.c_str());
+    }
+};
+
+TEST_CLASS(ProgramViewTests) {
+public:
+    TEST_METHOD(Should_evaluate_serialized_program_in_place) {
+        Compiler::Program program = Compiler::Compile(Postfix(L"(a+b)*(a+b) - x/3"));
+        const auto bytes = Serialization::Serialize(program);
+        Serialization::ProgramView view(bytes.data(), bytes.size());
+        const Bindings bindings{ { L"a", 1 }, { L"b", 2 }, { L"x", 6 } };
+        Assert::AreEqual(program.Evaluate(bindings), view.Evaluate(bindings));
+        Assert::IsTrue(program.Variables() == view.Variables());
+        Assert::AreEqual(program.StackDepth(), view.StackDepth());
+    }
+
+    TEST_METHOD(Should_evaluate_all_outputs_and_parameters_in_place) {
+        const auto outputs = Serialization::Serialize(Compiler::Compile(std::vector<Tokens>{ Postfix(L"x+1"), Postfix(L"x*x") }));
+        auto results = Serialization::ProgramView(outputs.data(), outputs.size()).EvaluateAll({ 3 });
+        Assert::AreEqual(4.0, results[0]);
+        Assert::AreEqual(9.0, results[1]);
+        const auto shape = Serialization::Serialize(Compiler::CompileShape(Ast::Build(Postfix(L"x*2"))));
+        Assert::AreEqual(6.0, Serialization::ProgramView(shape.data(), shape.size()).Evaluate(std::vector<double>{ 3 }, { 2 }));
+    }
+
+    TEST_METHOD(Should_evaluate_view_in_scratch) {
+        Compiler::Program program = Compiler::Compile(Postfix(L"(a+b)*(a+b) - x/3"));
+        const auto bytes = Serialization::Serialize(program);
+        Serialization::ProgramView view(bytes.data(), bytes.size());
+        Compiler::Scratch scratch;
+        const Bindings bindings{ { L"a", 1 }, { L"b", 2 }, { L"x", 6 } };
+        Assert::AreEqual(program.Evaluate(bindings), view.Evaluate(bindings, scratch));
+        Assert::AreEqual(program.Evaluate(bindings), view.Evaluate(bindings, scratch));
+        std::vector<double> results;
+        view.EvaluateAll(bindings, scratch, results);
+        Assert::AreEqual(program.Evaluate(bindings), results[0]);
+        Assert::ExpectException<std::logic_error>([&]() { view.Evaluate({ { L"a", 1 } }, scratch); });
+    }
+
+    TEST_METHOD(Should_throw_when_view_of_corrupted_program) {
+        auto bytes = Serialization::Serialize(Compiler::Compile(Postfix(L"a*2")));
+        bytes[sizeof(Serialization::Detail::ProgramHeader)] ^= 1;
+        Assert::ExpectException<std::runtime_error>([&bytes]() { Serialization::ProgramView(bytes.data(), bytes.size()); });
+    }
+
+    TEST_METHOD(Should_evaluate_programs_from_pack_file) {
+        const std::string path = "ProgramViewTests.pack";
+        Serialization::WritePack(path, { L"rate*100", L"(a+b)/2" });
+        {
+            Serialization::ProgramFile pack(path);
+            Assert::AreEqual(250.0, pack.View(L"rate*100").Evaluate({ { L"rate", 2.5 } }));
+            Assert::AreEqual(2.0, pack.View(L"(a+b)/2").Evaluate({ { L"a", 1 }, { L"b", 3 } }));
+            Assert::ExpectException<std::runtime_error>([&pack]() { pack.View(L"a"); });
+        }
+        std::remove(path.c_str());
+    }
+};
+
+}
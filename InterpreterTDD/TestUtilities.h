@@ -0,0 +1,40 @@
+#pragma once
+#include "CppUnitTest.h"
+#include "Interpreter.h"
+
+namespace InterpreterTests {
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Interpreter;
+using namespace std;
+
+namespace AssertRange {
+
+template<class T, class ActualRange>
+static void AreEqual(initializer_list<T> expect, const ActualRange &actual) {
+    auto actualIter = begin(actual);
+    auto expectIter = begin(expect);
+
+    Assert::AreEqual(distance(expectIter, end(expect)), distance(actualIter, end(actual)), L"Size differs.");
+
+    for(; expectIter != end(expect) && actualIter != end(actual); ++expectIter, ++actualIter) {
+        auto message = L"Mismatch at position " + to_wstring(distance(begin(expect), expectIter));
+        Assert::AreEqual<T>(*expectIter, *actualIter, message.c_str());
+    }
+}
+
+} // namespace AssertRange
+
+const Token plus(MakeToken(Operator::Plus)), minus(MakeToken(Operator::Minus));
+const Token mul(MakeToken(Operator::Mul)), div(MakeToken(Operator::Div));
+const Token pLeft(MakeToken(Operator::LParen)), pRight(MakeToken(Operator::RParen));
+const Token uPlus(MakeToken(Operator::UPlus)), uMinus(MakeToken(Operator::UMinus));
+const Token _1(MakeToken(1)), _2(MakeToken(2)), _3(MakeToken(3)), _4(MakeToken(4)), _5(MakeToken(5));
+const Token a(MakeToken(Variable{ L"a" })), b(MakeToken(Variable{ L"b" })), x(MakeToken(Variable{ L"x" }));
+
+
+inline Tokens Postfix(const wstring &expression) {
+    return Parser::Parse(Lexer::MarkUnaryOperators(Lexer::Tokenize(expression)));
+}
+
+} // namespace InterpreterTests
@@ -6,4 +6,6 @@
 #include <algorithm>
 #include <functional>
 #include <unordered_map>
-#include <memory>
\ No newline at end of file
+#include <memory>
+#include <cmath>
+#include <limits>
\ No newline at end of file